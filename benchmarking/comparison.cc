@@ -2,14 +2,30 @@
 #include <string>
 #include <cstring>
 #include <set>
+#include <cstdio>
+#include <optional>
+#include <tuple>
+#include <latch>
+#include <thread>
 #include <pasta/bit_vector/bit_vector.hpp>
 #include <pasta/bit_vector/support/rank_select.hpp>
 #include <pasta/bit_vector/support/rank.hpp>
 #include <pasta/bit_vector/support/flat_rank.hpp>
 #include <pasta/bit_vector/support/flat_rank_select.hpp>
 #include <orzo/orzo.h>
+#include <orzo/elias_fano.h>
+#include <orzo/auto_orzo.h>
+#include <orzo/compressed_orzo.h>
+#include <orzo/orzo_view.h>
+#include <orzo/wavelet_matrix.h>
+#include <orzo/orzo_collection.h>
+#include <orzo/dynamic_orzo.h>
+#include <orzo/streaming_orzo.h>
 #include <orzo/utils.h>
 #include <orzo/bitvector.h>
+#include <orzo/allocator.h>
+#include "perf_counters.h"
+#include "workload.h"
 
 #ifdef __linux__
 #include <sched.h>
@@ -45,40 +61,157 @@ void set_affinity(size_t id = 1) {
     return;
 }
 
-void compare(std::string query_type, size_t size, size_t sparsity, size_t seed) {
-    set_affinity();
+/*
+ * Reruns the orzo queries with the bit vector and index placed by Allocator
+ * and reports time and dTLB load misses per query next to those of orzo,
+ * which uses the default allocator. On large vectors nearly every random
+ * query misses the TLB with 4 KiB pages, which huge pages mostly avoid.
+ */
+template<typename Allocator>
+void compare_allocator(
+    std::string allocator_name,
+    Allocator allocator,
+    Orzo<> &orzo,
+    uint64_t *bv2,
+    std::vector<size_t> &access_order,
+    std::string query_type,
+    size_t size,
+    size_t sparsity
+) {
+    if (query_type == "select0") {
+        cerr << "allocator comparison is only run for rank and select" << endl;
+        return;
+    }
     bool do_rank = query_type == "rank";
-    if (do_rank) {
-        cerr << "Query type: rank" << endl;
+    OrzoBitvector<Allocator> alloc_bv(size, 5632, allocator);
+    uint64_t *bv3 = alloc_bv.data();
+    memcpy(bv3, bv2, ((size + 63) / 64) * sizeof(*bv3));
+    Orzo<512, 128, 10, true, true, false, Allocator> alloc_orzo(
+        bv3, size, std::thread::hardware_concurrency(), allocator
+    );
+    bool counted = true;
+    auto run = [&](auto &o, uint64_t *b, uint64_t &dtlb_misses) {
+        DtlbLoadMissCounter dtlb;
+        counted = counted && dtlb.valid();
+        flush_cache();
+        [[maybe_unused]]
+        static volatile size_t sink = 0;
+        dtlb.start();
+        auto start = std::chrono::system_clock::now();
+        for (size_t idx = 0; idx < access_order.size(); idx++) {
+            sink = (do_rank) ? o.rank1(b, access_order[idx]) : o.select1(b, access_order[idx]);
+        }
+        auto end = std::chrono::system_clock::now();
+        dtlb_misses = dtlb.stop();
+        std::chrono::duration<double> elapsed = end - start;
+        return elapsed / access_order.size();
+    };
+    uint64_t default_misses, alloc_misses;
+    auto default_elapsed = run(orzo, bv2, default_misses);
+    auto alloc_elapsed = run(alloc_orzo, bv3, alloc_misses);
+    double queries = (double) access_order.size();
+    cerr << "Elapsed time for orzo " << query_type << " (malloc): " << default_elapsed.count() << endl;
+    cerr << "Elapsed time for orzo " << query_type << " (" << allocator_name << "): "
+        << alloc_elapsed.count() << endl;
+    if (!counted) {
+        cerr << "dTLB load misses unavailable (perf_event_open failed)" << endl;
     } else {
-        cerr << "Query type: select" << endl;
+        cerr << "dTLB load misses per query (malloc): " << default_misses / queries << endl;
+        cerr << "dTLB load misses per query (" << allocator_name << "): " << alloc_misses / queries << endl;
+        if (default_misses) {
+            cerr << "dTLB load miss saving: "
+                << 100.0 * (1.0 - ((double) alloc_misses / (double) default_misses)) << "%" << endl;
+        }
+    }
+    cout << "orzo_" << allocator_name << "," << query_type << "," << sparsity
+        << "," << size << "," << alloc_elapsed.count() << endl;
+}
+
+/*
+ * Reruns the orzo queries on another backend (ex. EliasFanoOrzo), which
+ * answers them without reading the bit vector, and reports its time and
+ * space next to those of orzo.
+ */
+template<typename Backend>
+void compare_backend(
+    std::string backend_name,
+    Backend &backend,
+    Orzo<> &orzo,
+    uint64_t *bv2,
+    std::vector<size_t> &access_order,
+    std::string query_type,
+    size_t size,
+    size_t sparsity
+) {
+    if (query_type == "select0") {
+        cerr << backend_name << " comparison is only run for rank and select" << endl;
+        return;
+    }
+    bool do_rank = query_type == "rank";
+    flush_cache();
+    [[maybe_unused]]
+    static volatile size_t sink = 0;
+    [[maybe_unused]]
+    size_t incorrect_count = 0;
+    QueryLoopCounters counters(backend_name + " " + query_type, access_order.size());
+    counters.start();
+    auto start = std::chrono::system_clock::now();
+    for (size_t idx = 0; idx < access_order.size(); idx++) {
+        size_t result = (do_rank) ? backend.rank1(bv2, access_order[idx]) : backend.select1(bv2, access_order[idx]);
+        sink = result;
+#ifdef CHECK_CORRECTNESS
+        size_t expected = (do_rank) ? orzo.rank1(bv2, access_order[idx]) : orzo.select1(bv2, access_order[idx]);
+        incorrect_count += (result != expected);
+#endif
+    }
+    auto end = std::chrono::system_clock::now();
+    counters.stop();
+    std::chrono::duration<double> elapsed = (end - start) / access_order.size();
+#ifdef CHECK_CORRECTNESS
+    cerr << ((incorrect_count == 0) ? "correct_" : "incorrect_") << backend_name << "_" << query_type << endl;
+#endif
+    cerr << "Elapsed time for " << backend_name << " " << query_type << ": " << elapsed.count() << endl;
+    cerr << "Bytes for orzo (bit vector and index): " << ((size + 7) / 8) + orzo.space_usage() << endl;
+    cerr << "Bytes for " << backend_name << ": " << backend.space_usage() << endl;
+    cout << backend_name << "," << query_type << "," << sparsity
+        << "," << size << "," << elapsed.count() << endl;
+}
+
+// path is a raw bit vector file (see BitFile) to use in place of a random one
+void compare(std::string query_type, size_t size, size_t sparsity, size_t seed, std::string allocator, std::string path) {
+    bool do_rank = query_type == "rank";
+    std::optional<BitFile> file;
+    if (!path.empty()) {
+        file.emplace(path);
+        size = file->size();
     }
-    cerr << "Seed is: " << seed << endl;
-    cerr << "BV size is: " << size << endl;
-    cerr << "BV sparsity is: " << sparsity << endl;
     uint64_t query_count = 10000000;
     std::vector<uint64_t> orzo_rank_v;
     std::vector<uint64_t> orzo_select_v;
     std::vector<uint64_t> pasta_rank_v;
     std::vector<uint64_t> pasta_select_v;
-    pasta::BitVector bv(size, 0);
     OrzoBitvector pssg_bv(size, 5632);
-    size_t hot_count = 0;
-    for (size_t i = 0; i < bv.size(); i++) {
-        auto x = random_integer<size_t>(1, 100, seed);
-        if (x > sparsity) {
-            //cerr << "wut?" << endl;
-            bv[i] = 1;
-            pssg_bv.set_bit(i);
-            ++hot_count;
-        }
-    }
     uint64_t *bv2 = pssg_bv.data();
+    size_t hot_count = (file) ? file->copy_to(bv2) : fill_random_bits(bv2, size, sparsity, seed);
+    if (file) {
+        sparsity = measured_sparsity(hot_count, size);
+    }
+    pasta::BitVector bv(size, 0);
+    copy_words(bv.data().data(), bv2, (size + 63) / 64);
+    // pinned once the vector is filled, the threads filling it inherit the mask
+    set_affinity();
+    cerr << "Query type: " << query_type << endl;
+    cerr << "Seed is: " << seed << endl;
+    cerr << "BV " << ((file) ? "file is: " + path : "is random") << endl;
+    cerr << "BV size is: " << size << endl;
+    cerr << "BV sparsity is: " << sparsity << endl;
     std::vector<size_t> access_order;
     cerr << "Hot bits: " << hot_count << endl;
     for (size_t idx = 0; idx < query_count; idx++) {
         if (do_rank) {
             access_order.push_back(random_integer<size_t>(1, size));
+        } else if (query_type == "select0") {
+            access_order.push_back(random_integer<size_t>(1, size - hot_count, seed));
         } else { // for select
             size_t rand = random_integer<size_t>(1, hot_count, seed);
             access_order.push_back(rand);
@@ -93,6 +226,8 @@ void compare(std::string query_type, size_t size, size_t sparsity, size_t seed)
         flush_cache();
         [[maybe_unused]]
         static volatile size_t i1 = 0;
+        QueryLoopCounters poppy_rank_counters("poppy rank", query_count);
+        poppy_rank_counters.start();
         auto poppy_rank_start = std::chrono::system_clock::now();
         for (size_t idx = 0; idx < query_count; idx++) {
             [[maybe_unused]]
@@ -100,12 +235,15 @@ void compare(std::string query_type, size_t size, size_t sparsity, size_t seed)
             i1 = unused;
         }
         auto poppy_rank_end = std::chrono::system_clock::now();
+        poppy_rank_counters.stop();
         std::chrono::duration<double> poppy_rank_elapsed = poppy_rank_end - poppy_rank_start;
         cerr << "finished poppy rank" << endl;
         // ORZO RANK
         flush_cache();
         [[maybe_unused]]
         static volatile size_t i3 = 0;
+        QueryLoopCounters orzo_rank_counters("orzo rank", query_count);
+        orzo_rank_counters.start();
         auto orzo_rank_start = std::chrono::system_clock::now();
         for (size_t idx = 0; idx < query_count; idx++) {
             [[maybe_unused]]
@@ -116,12 +254,26 @@ void compare(std::string query_type, size_t size, size_t sparsity, size_t seed)
 #endif
         }
         auto orzo_rank_end = std::chrono::system_clock::now();
+        orzo_rank_counters.stop();
         std::chrono::duration<double> orzo_rank_elapsed = orzo_rank_end - orzo_rank_start;
         cerr << "finished orzo rank" << endl;
+        // ORZO BATCHED RANK
+        flush_cache();
+        std::vector<uint64_t> orzo_rank_batch_v(query_count);
+        QueryLoopCounters orzo_rank_batch_counters("orzo rank batch", query_count);
+        orzo_rank_batch_counters.start();
+        auto orzo_rank_batch_start = std::chrono::system_clock::now();
+        orzo.rank1_batch(bv2, access_order.data(), orzo_rank_batch_v.data(), query_count);
+        auto orzo_rank_batch_end = std::chrono::system_clock::now();
+        orzo_rank_batch_counters.stop();
+        std::chrono::duration<double> orzo_rank_batch_elapsed = orzo_rank_batch_end - orzo_rank_batch_start;
+        cerr << "finished orzo batched rank" << endl;
         // PASTA RANK 
         flush_cache();
         [[maybe_unused]]
         static volatile size_t i5 = 0;
+        QueryLoopCounters pasta_rank_counters("pasta rank", query_count);
+        pasta_rank_counters.start();
         auto pasta_rank_start = std::chrono::system_clock::now();
         for (size_t idx = 0; idx < query_count; idx++) {
             [[maybe_unused]]
@@ -132,21 +284,26 @@ void compare(std::string query_type, size_t size, size_t sparsity, size_t seed)
 #endif
         }
         auto pasta_rank_end = std::chrono::system_clock::now();
+        pasta_rank_counters.stop();
         std::chrono::duration<double> pasta_rank_elapsed = pasta_rank_end - pasta_rank_start;
         cerr << "finished pasta rank" << endl;
 
         orzo_rank_elapsed /= query_count;
+        orzo_rank_batch_elapsed /= query_count;
         pasta_rank_elapsed /= query_count;
         poppy_rank_elapsed /= query_count;
         cerr << "Elapsed time for pasta_flat rank: " << pasta_rank_elapsed.count() << endl;
         cerr << "Elapsed time for poppy rank: " << poppy_rank_elapsed.count() << endl;
         cerr << "Elapsed time for orzo rank: " << orzo_rank_elapsed.count() << endl;
+        cerr << "Elapsed time for orzo batched rank: " << orzo_rank_batch_elapsed.count() << endl;
         cout << "pasta," << query_type << "," << sparsity
             << "," << size << "," << pasta_rank_elapsed.count() << endl;
         cout << "poppy," << query_type << "," << sparsity
             << "," << size << "," << poppy_rank_elapsed.count() << endl;
         cout << "orzo," << query_type << "," << sparsity
             << "," << size << "," << orzo_rank_elapsed.count() << endl;
+        cout << "orzo_batch," << query_type << "," << sparsity
+            << "," << size << "," << orzo_rank_batch_elapsed.count() << endl;
 #ifdef CHECK_CORRECTNESS
         bool correct_orzo = true;
         size_t incorrect_count_orzo = 0;
@@ -161,12 +318,79 @@ void compare(std::string query_type, size_t size, size_t sparsity, size_t seed)
         }
         cerr << ((correct_orzo) ? "correct_orzo_rank" : "incorrect_orzo_rank") << endl;
         cerr << "incorrect orzo rank count: " << incorrect_count_orzo << endl;
+        bool correct_orzo_batch = std::equal(
+            pasta_rank_v.begin(), pasta_rank_v.end(), orzo_rank_batch_v.begin()
+        );
+        cerr << ((correct_orzo_batch) ? "correct_orzo_batch_rank" : "incorrect_orzo_batch_rank") << endl;
+#endif
+    } else if (query_type == "select0") {
+        // PASTA SELECT0 -----
+        flush_cache();
+        [[maybe_unused]]
+        static volatile size_t i7 = 0;
+        QueryLoopCounters pasta_select0_counters("pasta select0", query_count);
+        pasta_select0_counters.start();
+        auto pasta_select0_start = std::chrono::system_clock::now();
+        for (size_t idx = 0; idx < query_count; idx++) {
+            [[maybe_unused]]
+            size_t unused = pasta_flat.select0(access_order[idx]);
+            i7 = unused;
+#ifdef CHECK_CORRECTNESS
+            pasta_select_v.push_back(unused);
+#endif
+        }
+        auto pasta_select0_end = std::chrono::system_clock::now();
+        pasta_select0_counters.stop();
+        std::chrono::duration<double> pasta_select0_elapsed = pasta_select0_end - pasta_select0_start;
+        cerr << "finished pasta select0" << endl;
+        // ORZO SELECT0 -----
+        Orzo<512, 128, 10, true, true, true> orzo0(bv2, size);
+        flush_cache();
+        [[maybe_unused]]
+        static volatile size_t i8 = 0;
+        QueryLoopCounters orzo_select0_counters("orzo select0", query_count);
+        orzo_select0_counters.start();
+        auto orzo_select0_start = std::chrono::system_clock::now();
+        for (size_t idx = 0; idx < query_count; idx++) {
+            [[maybe_unused]]
+            size_t unused = orzo0.select0(bv2, access_order[idx]);
+            i8 = unused;
+#ifdef CHECK_CORRECTNESS
+            orzo_select_v.push_back(unused);
+#endif
+        }
+        auto orzo_select0_end = std::chrono::system_clock::now();
+        orzo_select0_counters.stop();
+        std::chrono::duration<double> orzo_select0_elapsed = orzo_select0_end - orzo_select0_start;
+        cerr << "finished orzo select0" << endl;
+        orzo_select0_elapsed /= query_count;
+        pasta_select0_elapsed /= query_count;
+        cerr << "Elapsed time for pasta_flat select0: " << pasta_select0_elapsed << endl;
+        cerr << "Elapsed time for orzo select0: " << orzo_select0_elapsed << endl;
+        cout << "pasta," << query_type << "," << sparsity
+            << "," << size << "," << pasta_select0_elapsed.count() << endl;
+        cout << "orzo," << query_type << "," << sparsity
+            << "," << size << "," << orzo_select0_elapsed.count() << endl;
+#ifdef CHECK_CORRECTNESS
+        size_t incorrect_count_orzo_select0 = 0;
+        for (size_t i = 0; i < pasta_select_v.size(); i++) {
+            if (pasta_select_v[i] != orzo_select_v[i]) {
+                incorrect_count_orzo_select0++;
+                if (incorrect_count_orzo_select0 < 10) {
+                    cerr << "incorrect orzo select0 index" << i << endl;
+                }
+            }
+        }
+        cerr << ((incorrect_count_orzo_select0 == 0) ? "correct_orzo_select0" : "incorrect_orzo_select0") << endl;
+        cerr << "incorrect orzo select0 count: " << incorrect_count_orzo_select0 << endl;
 #endif
     } else {
         // POPPY SELECT -----
         flush_cache();
         [[maybe_unused]]
         static volatile size_t i2 = 0;
+        QueryLoopCounters poppy_select_counters("poppy select", query_count);
+        poppy_select_counters.start();
         auto poppy_select_start = std::chrono::system_clock::now();
         for (size_t idx = 0; idx < query_count; idx++) {
             [[maybe_unused]]
@@ -174,12 +398,15 @@ void compare(std::string query_type, size_t size, size_t sparsity, size_t seed)
             i2 = unused;
         }
         auto poppy_select_end = std::chrono::system_clock::now();
+        poppy_select_counters.stop();
         std::chrono::duration<double> poppy_select_elapsed = poppy_select_end - poppy_select_start;
         cerr << "finished poppy select" << endl;
         // PASTA SELECT -----
         flush_cache();
         [[maybe_unused]]
         static volatile size_t i6 = 0;
+        QueryLoopCounters pasta_select_counters("pasta select", query_count);
+        pasta_select_counters.start();
         auto pasta_select_start = std::chrono::system_clock::now();
         for (size_t idx = 0; idx < query_count; idx++) {
             [[maybe_unused]]
@@ -190,12 +417,15 @@ void compare(std::string query_type, size_t size, size_t sparsity, size_t seed)
 #endif
         }
         auto pasta_select_end = std::chrono::system_clock::now();
+        pasta_select_counters.stop();
         std::chrono::duration<double> pasta_select_elapsed = pasta_select_end - pasta_select_start;
         cerr << "finished pasta select" << endl;
         // ORZO SELECT -----
         flush_cache();
         [[maybe_unused]]
         static volatile size_t i4 = 0;
+        QueryLoopCounters orzo_select_counters("orzo select", query_count);
+        orzo_select_counters.start();
         auto orzo_select_start = std::chrono::system_clock::now();
         for (size_t idx = 0; idx < query_count; idx++) {
             [[maybe_unused]]
@@ -206,20 +436,36 @@ void compare(std::string query_type, size_t size, size_t sparsity, size_t seed)
 #endif
         }
         auto orzo_select_end = std::chrono::system_clock::now();
+        orzo_select_counters.stop();
         std::chrono::duration<double> orzo_select_elapsed = orzo_select_end - orzo_select_start;
         cerr << "finished orzo select" << endl;
+        // ORZO BATCHED SELECT -----
+        flush_cache();
+        std::vector<uint64_t> orzo_select_batch_v(query_count);
+        QueryLoopCounters orzo_select_batch_counters("orzo select batch", query_count);
+        orzo_select_batch_counters.start();
+        auto orzo_select_batch_start = std::chrono::system_clock::now();
+        orzo.select1_batch(bv2, access_order.data(), orzo_select_batch_v.data(), query_count);
+        auto orzo_select_batch_end = std::chrono::system_clock::now();
+        orzo_select_batch_counters.stop();
+        std::chrono::duration<double> orzo_select_batch_elapsed = orzo_select_batch_end - orzo_select_batch_start;
+        cerr << "finished orzo batched select" << endl;
         orzo_select_elapsed /= query_count;
+        orzo_select_batch_elapsed /= query_count;
         pasta_select_elapsed /= query_count;
         poppy_select_elapsed /= query_count;
         cerr << "Elapsed time for pasta_flat select: " << pasta_select_elapsed << endl;
         cerr << "Elapsed time for poppy select: " << poppy_select_elapsed << endl;
         cerr << "Elapsed time for orzo select: " << orzo_select_elapsed << endl;
+        cerr << "Elapsed time for orzo batched select: " << orzo_select_batch_elapsed << endl;
         cout << "pasta," << query_type << "," << sparsity
             << "," << size << "," << pasta_select_elapsed.count() << endl;
         cout << "poppy," << query_type << "," << sparsity
             << "," << size << "," << poppy_select_elapsed.count() << endl;
         cout << "orzo," << query_type << "," << sparsity
             << "," << size << "," << orzo_select_elapsed.count() << endl;
+        cout << "orzo_batch," << query_type << "," << sparsity
+            << "," << size << "," << orzo_select_batch_elapsed.count() << endl;
 #ifdef CHECK_CORRECTNESS
         bool correct_orzo_select = true;
         size_t incorrect_count_orzo_select = 0;
@@ -235,20 +481,653 @@ void compare(std::string query_type, size_t size, size_t sparsity, size_t seed)
         }
         cerr << ((correct_orzo_select) ? "correct_orzo_select" : "incorrect_orzo_select") << endl;
         cerr << "incorrect orzo select count: " << incorrect_count_orzo_select << endl;
+        bool correct_orzo_batch_select = std::equal(
+            pasta_select_v.begin(), pasta_select_v.end(), orzo_select_batch_v.begin()
+        );
+        cerr << ((correct_orzo_batch_select) ? "correct_orzo_batch_select" : "incorrect_orzo_batch_select") << endl;
+#endif
+    }
+    {
+        EliasFanoOrzo<> ef(bv2, size);
+        compare_backend("orzo_ef", ef, orzo, bv2, access_order, query_type, size, sparsity);
+        AutoOrzo<> auto_orzo(bv2, size);
+        cerr << "AutoOrzo picks: " << ((auto_orzo.sparse()) ? "elias-fano" : "orzo") << endl;
+    }
+    {
+        CompressedOrzo<> compressed(bv2, size);
+        compare_backend("orzo_compressed", compressed, orzo, bv2, access_order, query_type, size, sparsity);
+    }
+    if (allocator == "hugepage") {
+        compare_allocator("hugepage", HugePageAllocator<HUGE_PAGE_2M>(), orzo, bv2, access_order, query_type, size, sparsity);
+    } else if (allocator == "hugepage1g") {
+        compare_allocator("hugepage1g", HugePageAllocator<HUGE_PAGE_1G>(), orzo, bv2, access_order, query_type, size, sparsity);
+    } else if (allocator == "numa") {
+        compare_allocator("numa", NumaAllocator(), orzo, bv2, access_order, query_type, size, sparsity);
+    } else if (!allocator.empty()) {
+        cerr << "unknown allocator: " << allocator << endl;
+    }
+}
+
+/*
+ * Aggregate throughput of one OrzoView shared by 1, 2, 4, ... max_threads
+ * threads, each pinned to its own core and answering its own random queries,
+ * first one at a time and then batched. Each thread's time runs from a common
+ * start, so the slowest thread bounds the aggregate. Throughput stops growing
+ * where the threads saturate memory bandwidth (or run out of cores).
+ */
+void scaling(std::string query_type, size_t size, size_t sparsity, size_t seed, size_t max_threads, std::string path) {
+    bool do_rank = query_type == "rank";
+    size_t queries_per_thread = 2000000;
+    std::optional<BitFile> file;
+    if (!path.empty()) {
+        file.emplace(path);
+        size = file->size();
+    }
+    OrzoBitvector pssg_bv(size, 5632);
+    size_t hot_count = (file) ? file->copy_to(pssg_bv.data()) : fill_random_bits(pssg_bv.data(), size, sparsity, seed);
+    if (file) {
+        sparsity = measured_sparsity(hot_count, size);
+    }
+    cerr << "Query type: " << query_type << endl;
+    cerr << "BV size is: " << size << endl;
+    cerr << "BV sparsity is: " << sparsity << endl;
+    OrzoView<> view(pssg_bv.data(), size);
+    // random_integer is not thread safe, so every thread's queries are drawn here
+    std::vector<std::vector<uint64_t>> queries(max_threads);
+    for (auto &thread_queries : queries) {
+        for (size_t idx = 0; idx < queries_per_thread; idx++) {
+            thread_queries.push_back((do_rank) ? random_integer<size_t>(0, size - 1) : random_integer<size_t>(1, hot_count));
+        }
+    }
+    size_t num_cores = std::max<size_t>(1, std::thread::hardware_concurrency());
+    auto run = [&](size_t num_threads, bool batched) {
+        // every thread and this one, so timing starts once all are ready
+        std::latch ready(num_threads + 1);
+        std::vector<std::thread> threads;
+        std::chrono::steady_clock::time_point start;
+        for (size_t t = 0; t < num_threads; ++t) {
+            threads.emplace_back([&, t]() {
+#ifdef __linux__
+                cpu_set_t mask;
+                CPU_ZERO(&mask);
+                CPU_SET(t % num_cores, &mask);
+                sched_setaffinity(0, sizeof(mask), &mask);
+#endif
+                const std::vector<uint64_t> &q = queries[t];
+                std::vector<uint64_t> out(q.size());
+                ready.arrive_and_wait();
+                if (batched) {
+                    (do_rank) ? view.rank1_batch(q.data(), out.data(), q.size())
+                        : view.select1_batch(q.data(), out.data(), q.size());
+                } else {
+                    for (size_t idx = 0; idx < q.size(); idx++) {
+                        out[idx] = (do_rank) ? view.rank1(q[idx]) : view.select1(q[idx]);
+                    }
+                }
+                [[maybe_unused]]
+                volatile uint64_t sink = out[q.size() - 1];
+            });
+        }
+        ready.arrive_and_wait();
+        start = std::chrono::steady_clock::now();
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double queries_per_second = (double) (num_threads * queries_per_thread) / elapsed.count();
+        std::string name = (batched) ? "orzo_batch" : "orzo";
+        cerr << "Queries/sec for " << name << " " << query_type << " on " << num_threads
+            << " threads: " << queries_per_second << endl;
+        cout << name << "," << query_type << "_scaling," << sparsity << "," << size
+            << "," << num_threads << "," << queries_per_second << endl;
+    };
+    for (size_t num_threads = 1; ; num_threads = std::min(num_threads * 2, max_threads)) {
+        run(num_threads, false);
+        run(num_threads, true);
+        if (num_threads == max_threads) {
+            break;
+        }
+    }
+}
+
+/*
+ * Bulk enumeration against query at a time loops: the positions of the first
+ * ones by select1 per rank, by select_range and by ones(), then rank1 of a
+ * sorted list of positions by rank1 per position and by rank1_sorted. Times
+ * are per one (per position for rank) and the enumerations also report the
+ * bit vector bytes they cover per second, to compare against memory bandwidth.
+ */
+void enumerate(size_t size, size_t sparsity, size_t seed, std::string path) {
+    std::optional<BitFile> file;
+    if (!path.empty()) {
+        file.emplace(path);
+        size = file->size();
+    }
+    OrzoBitvector pssg_bv(size, 5632);
+    size_t hot_count = (file) ? file->copy_to(pssg_bv.data()) : fill_random_bits(pssg_bv.data(), size, sparsity, seed);
+    if (file) {
+        sparsity = measured_sparsity(hot_count, size);
+    }
+    cerr << "BV size is: " << size << endl;
+    cerr << "BV sparsity is: " << sparsity << endl;
+    const uint64_t *bv = pssg_bv.data();
+    Orzo<> orzo(bv, size);
+    set_affinity();
+    size_t one_count = std::min<size_t>(hot_count, 1ULL << 26);
+    if (one_count == 0) {
+        cerr << "no ones to enumerate" << endl;
+        return;
+    }
+    std::vector<uint64_t> loop_v(one_count), range_v(one_count), iter_v;
+    iter_v.reserve(one_count);
+    auto timed = [&](std::string name, size_t count, uint64_t covered_bits, auto &&body) {
+        flush_cache();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double ns = 1e9 * elapsed.count() / (double) count;
+        double gbps = (double) covered_bits / 8 / elapsed.count() / 1e9;
+        cerr << name << ": " << ns << " ns per item, " << gbps << " GB/s of bit vector" << endl;
+        cout << name << ",enumerate," << sparsity << "," << size << "," << ns << "," << gbps << endl;
+    };
+    // the ones enumerated lie in [0, last one's position]
+    uint64_t covered = orzo.select1(bv, one_count) + 1;
+    timed("orzo_select_loop", one_count, covered, [&]() {
+        for (size_t r = 1; r <= one_count; ++r) {
+            loop_v[r - 1] = orzo.select1(bv, r);
+        }
+    });
+    timed("orzo_select_range", one_count, covered, [&]() {
+        orzo.select_range(bv, 1, one_count + 1, range_v.data());
+    });
+    timed("orzo_ones", one_count, covered, [&]() {
+        for (uint64_t position : orzo.ones(bv)) {
+            iter_v.push_back(position);
+            if (iter_v.size() == one_count) break;
+        }
+    });
+    // sorted uniform positions, about one per 64 bits
+    size_t position_count = std::max<size_t>(1, std::min<size_t>(size / 64, 1ULL << 24));
+    std::vector<uint64_t> positions(position_count);
+    for (auto &position : positions) {
+        position = random_integer<size_t>(0, size - 1);
+    }
+    std::sort(positions.begin(), positions.end());
+    std::vector<uint64_t> rank_v(position_count), sorted_v(position_count);
+    timed("orzo_rank_loop", position_count, size, [&]() {
+        for (size_t k = 0; k < position_count; ++k) {
+            rank_v[k] = orzo.rank1(bv, positions[k]);
+        }
+    });
+    timed("orzo_rank_sorted", position_count, size, [&]() {
+        orzo.rank1_sorted(bv, positions.data(), sorted_v.data(), position_count);
+    });
+#ifdef CHECK_CORRECTNESS
+    bool correct = (loop_v == range_v) && (loop_v == iter_v) && (rank_v == sorted_v);
+    cerr << ((correct) ? "correct" : "incorrect") << " orzo enumeration" << endl;
+#endif
+}
+
+/*
+ * Builds the indexed AND, OR, XOR and ANDNOT of two random bit vectors of
+ * size bits, first as a loop over the words followed by the Orzo constructor,
+ * then with Orzo::combine, and reports each in ns per word of the result and
+ * GB/s of input bit vectors.
+ */
+void combine(size_t size, size_t sparsity, size_t seed, size_t num_threads) {
+    OrzoBitvector a_bv(size, 5632), b_bv(size, 5632), two_pass_bv(size, 5632), fused_bv(size, 5632);
+    fill_random_bits(a_bv.data(), size, sparsity, seed);
+    fill_random_bits(b_bv.data(), size, sparsity, seed + 1);
+    const uint64_t *a = a_bv.data();
+    const uint64_t *b = b_bv.data();
+    // whole basic blocks, which both builds read and write
+    size_t word_count = ((size + 511) / 512) * 8;
+    cerr << "BV size is: " << size << endl;
+    cerr << "BV sparsity is: " << sparsity << endl;
+    auto timed = [&](std::string name, auto &&body) {
+        flush_cache();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double ns = 1e9 * elapsed.count() / (double) word_count;
+        double gbps = 2.0 * (double) size / 8 / elapsed.count() / 1e9;
+        cerr << name << ": " << ns << " ns per word, " << gbps << " GB/s of input" << endl;
+        cout << name << ",combine," << sparsity << "," << size << "," << ns << "," << gbps << endl;
+    };
+    auto run = [&]<SetOp op>(std::string op_name) {
+        std::optional<Orzo<>> two_pass, fused;
+        timed("orzo_" + op_name + "_two_pass", [&]() {
+            uint64_t *out = two_pass_bv.data();
+            parallel_for((word_count + WORKLOAD_SLAB_WORDS - 1) / WORKLOAD_SLAB_WORDS, num_threads, [&](size_t slab) {
+                size_t last = std::min<size_t>(word_count, (slab + 1) * WORKLOAD_SLAB_WORDS);
+                for (size_t w = slab * WORKLOAD_SLAB_WORDS; w < last; ++w) {
+                    out[w] = apply_set_op<op>(a[w], b[w]);
+                }
+            });
+            two_pass.emplace(out, size, num_threads);
+        });
+        timed("orzo_" + op_name + "_combine", [&]() {
+            fused.emplace(Orzo<>::combine<op>(a, b, fused_bv.data(), size, num_threads));
+        });
+#ifdef CHECK_CORRECTNESS
+        bool correct = (two_pass->get_one_count() == fused->get_one_count())
+            && (memcmp(two_pass_bv.data(), fused_bv.data(), word_count * sizeof(uint64_t)) == 0);
+        for (size_t k = 0; correct && (k < 100000); ++k) {
+            uint64_t i = random_integer<size_t>(0, size - 1);
+            correct &= two_pass->rank1(two_pass_bv.data(), i) == fused->rank1(fused_bv.data(), i);
+            if (fused->get_one_count()) {
+                uint64_t r = 1 + (i % fused->get_one_count());
+                correct &= two_pass->select1(two_pass_bv.data(), r) == fused->select1(fused_bv.data(), r);
+            }
+        }
+        cerr << ((correct) ? "correct" : "incorrect") << " orzo " << op_name << endl;
+#endif
+    };
+    run.template operator()<SetOp::AND>("and");
+    run.template operator()<SetOp::OR>("or");
+    run.template operator()<SetOp::XOR>("xor");
+    run.template operator()<SetOp::ANDNOT>("andnot");
+}
+
+/*
+ * Indexes count random bit vectors of 1 to max_size bits each, once as one
+ * Orzo and OrzoBitvector per bit vector and once in an OrzoCollection, and
+ * reports the bytes each takes per bit vector and rank and select times over
+ * random bit vectors, in ns per query. Bytes for the separate indices count
+ * their objects and arrays but not the heap's own overhead per allocation.
+ */
+void collection(size_t count, size_t max_size, size_t sparsity, size_t seed) {
+    size_t query_count = 1000000;
+    std::mt19937_64 rng(seed);
+    std::vector<OrzoBitvector<>> bvs;
+    std::vector<Orzo<>> orzos;
+    std::vector<uint64_t> sizes(count), one_counts(count);
+    bvs.reserve(count);
+    orzos.reserve(count);
+    OrzoCollection<> packed;
+    uint64_t separate_bytes = 0;
+    uint64_t bit_count = 0;
+    std::chrono::duration<double> separate_build{}, packed_build{};
+    uint64_t arena_words = 0;
+    for (size_t id = 0; id < count; ++id) {
+        sizes[id] = 1 + (rng() % max_size);
+        arena_words += OrzoCollection<>::entry_words(sizes[id]);
+    }
+    packed.reserve(arena_words);
+    for (size_t id = 0; id < count; ++id) {
+        bit_count += sizes[id];
+        bvs.emplace_back(sizes[id], 512);
+        one_counts[id] = fill_random_bits(bvs.back().data(), sizes[id], sparsity, seed + id);
+        auto start = std::chrono::steady_clock::now();
+        orzos.emplace_back(bvs.back().data(), sizes[id], 1);
+        separate_build += std::chrono::steady_clock::now() - start;
+        separate_bytes += sizeof(Orzo<>) + sizeof(OrzoBitvector<>) + orzos.back().space_usage()
+            + (((sizes[id] + 511) / 512) * 64);
+        start = std::chrono::steady_clock::now();
+        packed.add(bvs.back().data(), sizes[id]);
+        packed_build += std::chrono::steady_clock::now() - start;
+    }
+    cerr << count << " bit vectors of 1 to " << max_size << " bits, " << bit_count << " bits in all" << endl;
+    set_affinity();
+    std::vector<uint64_t> ids(query_count), positions(query_count), ranks(query_count);
+    for (size_t k = 0; k < query_count; ++k) {
+        ids[k] = rng() % count;
+        positions[k] = rng() % sizes[ids[k]];
+        ranks[k] = (one_counts[ids[k]]) ? (1 + (rng() % one_counts[ids[k]])) : 0;
+    }
+    std::vector<uint64_t> separate_out(query_count), packed_out(query_count);
+    auto report = [&](std::string name, std::string query_type, double seconds) {
+        double ns = 1e9 * seconds / (double) query_count;
+        cerr << name << " " << query_type << ": " << ns << " ns per query" << endl;
+        cout << name << ",collection," << query_type << "," << sparsity << "," << max_size << "," << ns << endl;
+    };
+    auto timed = [&](auto &&body) {
+        flush_cache();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    };
+    for (auto [name, bytes, build] : {
+        std::tuple{"orzo_separate", separate_bytes, separate_build.count()},
+        std::tuple{"orzo_collection", packed.space_usage(), packed_build.count()}
+    }) {
+        cerr << name << ": " << ((double) bytes / (double) count) << " bytes per bit vector, "
+            << (8.0 * (double) bytes / (double) bit_count) << " bits per bit, built in " << build << " s" << endl;
+        cout << name << ",collection,space," << sparsity << "," << max_size << "," << ((double) bytes / (double) count) << endl;
+    }
+    report("orzo_separate", "rank", timed([&]() {
+        for (size_t k = 0; k < query_count; ++k) {
+            separate_out[k] = orzos[ids[k]].rank1(bvs[ids[k]].data(), positions[k]);
+        }
+    }));
+    report("orzo_collection", "rank", timed([&]() {
+        for (size_t k = 0; k < query_count; ++k) {
+            packed_out[k] = packed.rank1(ids[k], positions[k]);
+        }
+    }));
+#ifdef CHECK_CORRECTNESS
+    bool correct = separate_out == packed_out;
+#endif
+    report("orzo_separate", "select", timed([&]() {
+        for (size_t k = 0; k < query_count; ++k) {
+            separate_out[k] = (ranks[k]) ? orzos[ids[k]].select1(bvs[ids[k]].data(), ranks[k]) : 0;
+        }
+    }));
+    report("orzo_collection", "select", timed([&]() {
+        for (size_t k = 0; k < query_count; ++k) {
+            packed_out[k] = (ranks[k]) ? packed.select1(ids[k], ranks[k]) : 0;
+        }
+    }));
+#ifdef CHECK_CORRECTNESS
+    correct &= separate_out == packed_out;
+    cerr << ((correct) ? "correct" : "incorrect") << " orzo collection" << endl;
+#endif
+}
+
+/*
+ * Sequence queries on a WaveletMatrix of size uniform random symbols of
+ * symbol_bits bits: access one at a time and batched, rank, select and
+ * range_quantile over ranges of up to 1024 symbols, in ns per query.
+ */
+void wavelet(size_t size, size_t symbol_bits, size_t seed) {
+    size_t query_count = 1000000;
+    std::vector<uint64_t> symbols(size);
+    std::mt19937_64 rng(seed);
+    for (auto &symbol : symbols) {
+        symbol = rng() >> (64 - symbol_bits);
+    }
+    auto start = std::chrono::steady_clock::now();
+    WaveletMatrix<> wm(symbols.data(), size, symbol_bits);
+    std::chrono::duration<double> build = std::chrono::steady_clock::now() - start;
+    cerr << "Built " << wm.level_count() << " levels over " << size << " symbols in " << build.count()
+        << " s, " << (8.0 * (double) wm.space_usage() / (double) size) << " bits per symbol" << endl;
+    set_affinity();
+    std::vector<uint64_t> positions(query_count), out(query_count);
+    for (auto &position : positions) {
+        position = rng() % size;
+    }
+    [[maybe_unused]]
+    static volatile uint64_t sink = 0;
+    auto timed = [&](std::string name, auto &&body) {
+        flush_cache();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double ns = 1e9 * elapsed.count() / (double) query_count;
+        cerr << name << ": " << ns << " ns per query" << endl;
+        cout << name << ",wavelet," << symbol_bits << "," << size << "," << ns << endl;
+    };
+    timed("wm_access", [&]() {
+        for (size_t k = 0; k < query_count; ++k) {
+            out[k] = wm.access(positions[k]);
+        }
+    });
+    std::vector<uint64_t> batch_out(query_count);
+    timed("wm_access_batch", [&]() {
+        wm.access_batch(positions.data(), batch_out.data(), query_count);
+    });
+    timed("wm_rank", [&]() {
+        for (size_t k = 0; k < query_count; ++k) {
+            sink = wm.rank(symbols[positions[k]], positions[k]);
+        }
+    });
+    timed("wm_select", [&]() {
+        for (size_t k = 0; k < query_count; ++k) {
+            sink = wm.select(symbols[positions[k]], 1 + (k % 64));
+        }
+    });
+    timed("wm_range_quantile", [&]() {
+        for (size_t k = 0; k < query_count; ++k) {
+            uint64_t end = std::min<uint64_t>(size, positions[k] + 1 + (k % 1024));
+            sink = wm.range_quantile(positions[k], end, (end - positions[k]) / 2);
+        }
+    });
+#ifdef CHECK_CORRECTNESS
+    bool correct = out == batch_out;
+    for (size_t k = 0; k < query_count; ++k) {
+        correct &= out[k] == symbols[positions[k]];
+    }
+    cerr << ((correct) ? "correct" : "incorrect") << " wavelet access" << endl;
 #endif
+}
+
+/*
+ * Sets and clears update_count random bits of a random bit vector of size
+ * bits through a DynamicOrzo, each update followed by a rank1, then by a
+ * select1, then by a select0, and reports each update and query pair in ns.
+ * With CHECK_CORRECTNESS, rounds of updates few enough to leave the select
+ * samples lagging and many enough to have them placed again are each
+ * checked against an Orzo built over the updated bits.
+ */
+void update(size_t size, size_t sparsity, size_t seed, size_t update_count) {
+    using Dynamic = DynamicOrzo<512, 128, 10, true, true, true>;
+    OrzoBitvector dyn_bv(size, 5632);
+    uint64_t *bv = dyn_bv.data();
+    size_t hot_count = fill_random_bits(bv, size, sparsity, seed);
+    cerr << "BV size is: " << size << endl;
+    cerr << "BV sparsity is: " << sparsity << endl;
+    Dynamic dyn(bv, size);
+    set_affinity();
+    std::mt19937_64 rng(seed);
+    // every update moves the counts by at most one
+    uint64_t min_ones = std::max<int64_t>(1, (int64_t) hot_count - (int64_t) (3 * update_count));
+    uint64_t min_zeros = std::max<int64_t>(1, (int64_t) (size - hot_count) - (int64_t) (3 * update_count));
+    std::vector<uint64_t> positions(update_count);
+    [[maybe_unused]]
+    static volatile uint64_t sink = 0;
+    auto timed = [&](std::string name, auto &&query) {
+        for (auto &position : positions) {
+            position = rng() % size;
+        }
+        flush_cache();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t k = 0; k < update_count; ++k) {
+            if (k % 2) {
+                dyn.clear_bit(bv, positions[k]);
+            } else {
+                dyn.set_bit(bv, positions[k]);
+            }
+            sink = query(positions[k]);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double ns = 1e9 * elapsed.count() / (double) update_count;
+        cerr << name << ": " << ns << " ns per update and query" << endl;
+        cout << name << ",update," << sparsity << "," << size << "," << ns << endl;
+    };
+    timed("orzo_dynamic_rank", [&](uint64_t position) {
+        return dyn.rank1(bv, (position * 7919) % size);
+    });
+    timed("orzo_dynamic_select", [&](uint64_t position) {
+        return dyn.select1(bv, 1 + (position % min_ones));
+    });
+    timed("orzo_dynamic_select0", [&](uint64_t position) {
+        return dyn.select0(bv, 1 + (position % min_zeros));
+    });
+#ifdef CHECK_CORRECTNESS
+    bool correct = true;
+    for (size_t round_updates : {1ul, 100ul, 20000ul}) {
+        for (size_t k = 0; k < round_updates; ++k) {
+            uint64_t position = rng() % size;
+            if (rng() % 2) {
+                dyn.set_bit(bv, position);
+            } else {
+                dyn.clear_bit(bv, position);
+            }
+        }
+        Orzo<512, 128, 10, true, true, true> rebuilt(bv, size);
+        uint64_t ones = rebuilt.get_one_count();
+        correct &= dyn.get_one_count() == ones;
+        for (size_t k = 0; k < 100000; ++k) {
+            uint64_t i = rng() % size;
+            correct &= dyn.rank1(bv, i) == rebuilt.rank1(bv, i);
+            correct &= dyn.rank0(bv, i) == rebuilt.rank0(bv, i);
+            if (ones) {
+                uint64_t r = 1 + (rng() % ones);
+                correct &= dyn.select1(bv, r) == rebuilt.select1(bv, r);
+            }
+            if (ones < size) {
+                uint64_t r = 1 + (rng() % (size - ones));
+                correct &= dyn.select0(bv, r) == rebuilt.select0(bv, r);
+            }
+        }
     }
+    cerr << ((correct) ? "correct" : "incorrect") << " orzo dynamic" << endl;
+#endif
+}
+
+/*
+ * Streams a random bit vector of size bits into a StreamingOrzo in chunks of
+ * 1 to 1024 words and reports the time per word pushed, finalize included,
+ * next to that of an Orzo built in one go. With CHECK_CORRECTNESS the
+ * streamed index, and the same index saved to path and mapped back, are
+ * checked against the one built in one go, as is a stream whose last pushed
+ * word is past the final length, which then ends on a whole lower block.
+ */
+void stream(size_t size, size_t sparsity, size_t seed, std::string path) {
+    using Streaming = StreamingOrzo<512, 128, 10, true, true, true>;
+    using Index = Orzo<512, 128, 10, true, true, true>;
+    // a spare lower block for the stream pushing a word past its length
+    OrzoBitvector full_bv(size + 5632, 5632);
+    uint64_t *bv = full_bv.data();
+    fill_random_bits(bv, size, sparsity, seed);
+    size_t word_count = (size + 63) / 64;
+    cerr << "BV size is: " << size << endl;
+    cerr << "BV sparsity is: " << sparsity << endl;
+    std::mt19937_64 rng(seed);
+    // pushes words [0, pushed_words) of bv in uneven chunks, then finalizes at bits
+    auto push = [&](Streaming &streaming, size_t pushed_words, size_t bits) {
+        for (size_t first = 0; first < pushed_words; ) {
+            size_t n = std::min<size_t>(1 + (rng() % 1024), pushed_words - first);
+            streaming.push_words(bv + first, n);
+            first += n;
+        }
+        streaming.finalize(bits);
+    };
+    auto timed = [&](std::string name, auto &&body) {
+        flush_cache();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double ns = 1e9 * elapsed.count() / (double) word_count;
+        cerr << name << ": " << ns << " ns per word" << endl;
+        cout << name << ",stream," << sparsity << "," << size << "," << ns << endl;
+    };
+    std::optional<Index> one_shot;
+    std::optional<Streaming> streamed;
+    timed("orzo_build", [&]() { one_shot.emplace(bv, size); });
+    timed("orzo_streaming", [&]() {
+        streamed.emplace(size);
+        push(*streamed, word_count, size);
+    });
+#ifdef CHECK_CORRECTNESS
+    // the queries of index over bits bits against those of the one built in one go
+    auto matches = [&](auto &index, const uint64_t *index_bv, Index &expected, size_t bits) {
+        uint64_t ones = expected.get_one_count();
+        bool correct = index.get_one_count() == ones;
+        for (size_t k = 0; correct && (k < 100000); ++k) {
+            uint64_t i = rng() % bits;
+            correct &= index.rank1(index_bv, i) == expected.rank1(bv, i);
+            correct &= index.rank0(index_bv, i) == expected.rank0(bv, i);
+            if (ones) {
+                uint64_t r = 1 + (rng() % ones);
+                correct &= index.select1(index_bv, r) == expected.select1(bv, r);
+            }
+            if (ones < bits) {
+                uint64_t r = 1 + (rng() % (bits - ones));
+                correct &= index.select0(index_bv, r) == expected.select0(bv, r);
+            }
+        }
+        return correct;
+    };
+    bool correct = streamed->sealed_count() == size;
+    correct &= matches(*streamed, streamed->mapped_data(), *one_shot, size);
+    streamed->save(path, streamed->mapped_data());
+    Index mapped = Index::map(path);
+    correct &= matches(mapped, mapped.mapped_data(), *one_shot, size);
+    // whole lower blocks of bits, then a zero word that is not part of them
+    size_t whole = std::max<size_t>(1, size / 5632) * 5632;
+    size_t whole_words = whole / 64;
+    bv[whole_words] = 0;
+    Index whole_index(bv, whole);
+    Streaming overhang(whole + 64);
+    push(overhang, whole_words + 1, whole);
+    correct &= overhang.sealed_count() == whole;
+    overhang.save(path, overhang.mapped_data());
+    Index overhang_mapped = Index::map(path);
+    correct &= matches(overhang_mapped, overhang_mapped.mapped_data(), whole_index, whole);
+    std::remove(path.c_str());
+    cerr << ((correct) ? "correct" : "incorrect") << " orzo streaming" << endl;
+#endif
+}
+
+// the size argument is either a number of bits or the path of a raw bit
+// vector file, whose size and sparsity then replace the given ones
+bool is_size(const char *arg) {
+    return *arg && std::string(arg).find_first_not_of("0123456789") == std::string::npos;
 }
 
 int main(int argc, char **argv) {
-    if (argc < 4) {
-        cerr << "Usage: orzo-benchmark <query type: 'rank' or 'select'> <size of bit vector> "
+    if (argc >= 6 && std::string(argv[1]) == "scaling") {
+        std::string query_type(argv[2]);
+        size_t max_threads = (argc > 6) ? atoi(argv[6]) : std::thread::hardware_concurrency();
+        std::string path = (is_size(argv[3])) ? "" : argv[3];
+        scaling(query_type, atoll(argv[3]), atoi(argv[4]), atoi(argv[5]), std::max<size_t>(1, max_threads), path);
+        return 0;
+    }
+    if (argc >= 5 && std::string(argv[1]) == "wavelet") {
+        wavelet(atoll(argv[2]), std::clamp(atoi(argv[3]), 1, 64), atoi(argv[4]));
+        return 0;
+    }
+    if (argc >= 5 && std::string(argv[1]) == "enumerate") {
+        std::string path = (is_size(argv[2])) ? "" : argv[2];
+        enumerate(atoll(argv[2]), atoi(argv[3]), atoi(argv[4]), path);
+        return 0;
+    }
+    if (argc >= 5 && std::string(argv[1]) == "combine") {
+        size_t num_threads = (argc > 5) ? atoi(argv[5]) : std::thread::hardware_concurrency();
+        combine(atoll(argv[2]), atoi(argv[3]), atoi(argv[4]), std::max<size_t>(1, num_threads));
+        return 0;
+    }
+    if (argc >= 5 && std::string(argv[1]) == "update") {
+        size_t update_count = (argc > 5) ? atoll(argv[5]) : 100000;
+        update(atoll(argv[2]), atoi(argv[3]), atoi(argv[4]), std::max<size_t>(1, update_count));
+        return 0;
+    }
+    if (argc >= 5 && std::string(argv[1]) == "stream") {
+        std::string path = (argc > 5) ? argv[5] : "orzo-stream.idx";
+        stream(std::max<size_t>(1, atoll(argv[2])), atoi(argv[3]), atoi(argv[4]), path);
+        return 0;
+    }
+    if (argc >= 6 && std::string(argv[1]) == "collection") {
+        collection(std::max<size_t>(1, atoll(argv[2])), std::max<size_t>(1, atoll(argv[3])), atoi(argv[4]), atoi(argv[5]));
+        return 0;
+    }
+    if (argc < 5) {
+        cerr << "Usage: orzo-benchmark <query type: 'rank', 'select' or 'select0'> <size of bit vector or raw bit vector file> "
+            "<~bv sparsity 0-99> <rng seed> "
+            "[allocator to compare against malloc: 'hugepage', 'hugepage1g' or 'numa']" << endl;
+        cerr << "       orzo-benchmark scaling <query type: 'rank' or 'select'> <size of bit vector or raw bit vector file> "
+            "<~bv sparsity 0-99> <rng seed> [max threads, default all cores]" << endl;
+        cerr << "       orzo-benchmark enumerate <size of bit vector or raw bit vector file> "
+            "<~bv sparsity 0-99> <rng seed>" << endl;
+        cerr << "       orzo-benchmark combine <size of bit vectors> <~bv sparsity 0-99> <rng seed> "
+            "[threads, default all cores]" << endl;
+        cerr << "       orzo-benchmark collection <number of bit vectors> <max bits per bit vector> "
             "<~bv sparsity 0-99> <rng seed>" << endl;
+        cerr << "       orzo-benchmark wavelet <number of symbols> <bits per symbol> <rng seed>" << endl;
+        cerr << "       orzo-benchmark update <size of bit vector> <~bv sparsity 0-99> <rng seed> "
+            "[updates, default 100000]" << endl;
+        cerr << "       orzo-benchmark stream <size of bit vector> <~bv sparsity 0-99> <rng seed> "
+            "[file the index is saved to and mapped from, default orzo-stream.idx]" << endl;
         return -1;
     }
     std::string query_type(argv[1]);
+    std::string path = (is_size(argv[2])) ? "" : argv[2];
     size_t size = atoll(argv[2]);
     size_t sparsity = atoi(argv[3]);
     size_t seed = atoi(argv[4]);
-    compare(query_type, size, sparsity, seed);
+    std::string allocator = (argc > 5) ? argv[5] : "";
+    compare(query_type, size, sparsity, seed, allocator, path);
     return 0;
 }
@@ -0,0 +1,183 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <orzo/instrument.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/*
+ * A single hardware counter for this thread, read around a query loop. When
+ * perf_event_open is unavailable (ex. perf_event_paranoid, containers, or not
+ * Linux) valid() is false and stop() returns 0.
+ */
+class PerfCounter {
+
+    private:
+
+        int fd = -1;
+
+    public:
+
+        PerfCounter(uint32_t type, uint64_t config) {
+#ifdef __linux__
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            this->fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+        }
+
+        PerfCounter(const PerfCounter&) = delete;
+        PerfCounter &operator=(const PerfCounter&) = delete;
+
+        ~PerfCounter() {
+            if (this->fd >= 0) {
+                close(this->fd);
+            }
+        }
+
+        bool valid() { return this->fd >= 0; }
+
+        void start() {
+#ifdef __linux__
+            if (this->valid()) {
+                ioctl(this->fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(this->fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        uint64_t stop() {
+            uint64_t count = 0;
+#ifdef __linux__
+            if (this->valid()) {
+                ioctl(this->fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(this->fd, &count, sizeof(count)) != sizeof(count)) {
+                    count = 0;
+                }
+            }
+#endif
+            return count;
+        }
+
+};
+
+// data TLB misses on loads, the cost huge pages remove for random queries
+class DtlbLoadMissCounter : public PerfCounter {
+
+    public:
+
+#ifdef __linux__
+        DtlbLoadMissCounter() : PerfCounter(
+            PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_DTLB
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+        ) {}
+#else
+        DtlbLoadMissCounter() : PerfCounter(0, 0) {}
+#endif
+
+};
+
+#ifdef __linux__
+// counters for PERF_TYPE_HARDWARE events
+class HardwareCounter : public PerfCounter {
+
+    public:
+
+        explicit HardwareCounter(uint64_t event) : PerfCounter(PERF_TYPE_HARDWARE, event) {}
+
+};
+#endif
+
+/*
+ * Cycles, last level cache misses, dTLB load misses and branch misses per
+ * query of a query loop, printed to stderr next to the loop's time. Built
+ * with PERF_COUNTERS (make PERF=1), otherwise start and stop do nothing so
+ * the loops are timed as before. With ORZO_INSTRUMENT, the select loop
+ * iterations counted in orzo are reported per query too. Counters the kernel
+ * refuses (ex. in a VM without a PMU) are left out.
+ */
+class QueryLoopCounters {
+
+    private:
+
+        std::string name;
+        size_t queries;
+#if defined(PERF_COUNTERS) && defined(__linux__)
+        HardwareCounter cycles{PERF_COUNT_HW_CPU_CYCLES};
+        HardwareCounter llc_misses{PERF_COUNT_HW_CACHE_MISSES};
+        DtlbLoadMissCounter dtlb_misses;
+        HardwareCounter branch_misses{PERF_COUNT_HW_BRANCH_MISSES};
+#endif
+#ifdef ORZO_INSTRUMENT
+        OrzoScanCounts scan_start;
+#endif
+
+    public:
+
+        QueryLoopCounters(std::string name, size_t queries) : name(name), queries(queries) {}
+
+        void start() {
+#ifdef ORZO_INSTRUMENT
+            this->scan_start = orzo_scan_counts;
+#endif
+#if defined(PERF_COUNTERS) && defined(__linux__)
+            this->cycles.start();
+            this->llc_misses.start();
+            this->dtlb_misses.start();
+            this->branch_misses.start();
+#endif
+        }
+
+        void stop() {
+#if defined(PERF_COUNTERS) && defined(__linux__)
+            // stopped in reverse so each counts as little of the others' ioctls as it can
+            uint64_t branch_count = this->branch_misses.stop();
+            uint64_t dtlb_count = this->dtlb_misses.stop();
+            uint64_t llc_count = this->llc_misses.stop();
+            uint64_t cycle_count = this->cycles.stop();
+            double n = (double) std::max<size_t>(this->queries, 1);
+            std::cerr << "Counters per query for " << this->name << ":";
+            auto print = [&](const char *label, PerfCounter &counter, uint64_t count) {
+                if (counter.valid()) std::cerr << " " << label << " " << count / n;
+            };
+            print("cycles", this->cycles, cycle_count);
+            print("llc_misses", this->llc_misses, llc_count);
+            print("dtlb_load_misses", this->dtlb_misses, dtlb_count);
+            print("branch_misses", this->branch_misses, branch_count);
+            if (!this->cycles.valid()) std::cerr << " (perf_event_open failed)";
+            std::cerr << std::endl;
+#endif
+#ifdef ORZO_INSTRUMENT
+            OrzoScanCounts scans = orzo_scan_counts - this->scan_start;
+            if (scans.selects) {
+                double n = (double) scans.selects;
+                std::cerr << "Select loop iterations per query for " << this->name << ":"
+                    << " lower_searches " << scans.lower_searches / n
+                    << " lower_scans " << scans.lower_scans / n
+                    << " l2_scans " << scans.l2_scans / n
+                    << " word_scans " << scans.word_scans / n << std::endl;
+            }
+#endif
+        }
+
+};
+
+#endif /* PERF_COUNTERS_H */
@@ -0,0 +1,436 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <x86intrin.h>
+#include <pasta/bit_vector/bit_vector.hpp>
+#include <pasta/bit_vector/support/rank_select.hpp>
+#include <pasta/bit_vector/support/flat_rank_select.hpp>
+#include <orzo/orzo.h>
+#include <orzo/interleaved_orzo.h>
+#include <orzo/bitvector.h>
+#include "workload.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+using std::cerr, std::endl, std::cout;
+using steady = std::chrono::steady_clock;
+
+/*
+ * Sweeps rank and select over sizes, sparsities and access patterns in one
+ * process for orzo, orzo with the interleaved layout, pasta flat and poppy. Each row reports build time, index
+ * space in bits per bit of the vector, mean time per query over an untimed
+ * loop, and p50/p99/p999 latency from every LATENCY_SAMPLE-th query of a
+ * second pass timed alone with rdtsc. Rows go to stdout as CSV or JSON,
+ * progress to stderr. Past what fits in memory, --write generates a vector
+ * into a file a slab at a time and --file with --map queries it in place,
+ * --structures orzo leaving out the pasta copies.
+ */
+
+constexpr size_t LATENCY_SAMPLE = 8;
+constexpr size_t WARMUP_QUERIES = 1 << 16;
+
+struct Row {
+    std::string structure;
+    std::string query_type;
+    std::string pattern;
+    size_t size;
+    size_t sparsity;
+    size_t run;
+    size_t queries;
+    size_t build_threads;
+    double build_seconds;
+    double bits_per_bit;
+    double mean_ns;
+    double p50_ns;
+    double p99_ns;
+    double p999_ns;
+};
+
+// nanoseconds per rdtsc tick, measured against steady_clock
+double tsc_ns_per_tick() {
+    auto start = steady::now();
+    uint64_t ticks = __rdtsc();
+    while (steady::now() - start < std::chrono::milliseconds(100));
+    ticks = __rdtsc() - ticks;
+    std::chrono::duration<double, std::nano> elapsed = steady::now() - start;
+    return elapsed.count() / (double) ticks;
+}
+
+// ticks of a fenced rdtsc pair around nothing, taken off every sample
+uint64_t tsc_overhead() {
+    uint64_t least = UINT64_MAX;
+    unsigned aux;
+    for (size_t i = 0; i < 10000; ++i) {
+        _mm_lfence();
+        uint64_t start = __rdtsc();
+        _mm_lfence();
+        uint64_t end = __rdtscp(&aux);
+        _mm_lfence();
+        least = std::min(least, end - start);
+    }
+    return least;
+}
+
+// pushes the previous structure's lines out of the caches
+void evict_caches(size_t nbytes = 64ULL << 20) {
+    static std::vector<char> bytes(nbytes);
+    [[maybe_unused]]
+    static volatile char sink;
+    for (size_t i = 0; i < bytes.size(); i += 64) {
+        bytes[i]++;
+    }
+    sink = bytes[bytes.size() / 2];
+}
+
+// pins to core id, or unpins (any core) when all is set
+void set_affinity(size_t id = 1, bool all = false) {
+#ifdef __linux__
+    size_t num_cores = std::max<size_t>(1, std::thread::hardware_concurrency());
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (size_t core = 0; core < num_cores; ++core) {
+        if (all || core == id % num_cores) CPU_SET(core, &mask);
+    }
+    if (sched_setaffinity(0, sizeof(mask), &mask) != 0) cerr << "failed to set affinity" << endl;
+#endif
+}
+
+double percentile(std::vector<uint64_t> &samples, double p) {
+    size_t idx = std::min(samples.size() - 1, (size_t) (p * (double) samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+    return (double) samples[idx];
+}
+
+/*
+ * Fills in the timing fields of row for query on queries. The first pass is
+ * the throughput the structure sustains when queries overlap, the second
+ * fences each sampled query so its time is its own latency. Unsampled
+ * queries still run in the second pass so the cache state matches the first.
+ */
+template<typename Query>
+void measure(Row &row, Query &&query, const std::vector<uint64_t> &queries, double ns_per_tick, uint64_t overhead) {
+    volatile uint64_t sink;
+    for (size_t idx = 0; idx < std::min(queries.size(), WARMUP_QUERIES); idx++) {
+        sink = query(queries[idx]);
+    }
+    evict_caches();
+    auto start = steady::now();
+    for (size_t idx = 0; idx < queries.size(); idx++) {
+        sink = query(queries[idx]);
+    }
+    std::chrono::duration<double, std::nano> elapsed = steady::now() - start;
+    row.mean_ns = elapsed.count() / (double) queries.size();
+    evict_caches();
+    std::vector<uint64_t> samples;
+    samples.reserve(queries.size() / LATENCY_SAMPLE + 1);
+    unsigned aux;
+    for (size_t idx = 0; idx < queries.size(); idx++) {
+        if (idx % LATENCY_SAMPLE) {
+            sink = query(queries[idx]);
+            continue;
+        }
+        _mm_lfence();
+        uint64_t begin = __rdtsc();
+        _mm_lfence();
+        sink = query(queries[idx]);
+        uint64_t end = __rdtscp(&aux);
+        _mm_lfence();
+        samples.push_back(std::max(end - begin, overhead) - overhead);
+    }
+    (void) sink;
+    row.p50_ns = percentile(samples, 0.5) * ns_per_tick;
+    row.p99_ns = percentile(samples, 0.99) * ns_per_tick;
+    row.p999_ns = percentile(samples, 0.999) * ns_per_tick;
+}
+
+void print_csv_header() {
+    cout << "structure,query_type,pattern,size,sparsity,run,queries,build_threads,"
+        "build_seconds,bits_per_bit,mean_ns,p50_ns,p99_ns,p999_ns" << endl;
+}
+
+void print_csv(const Row &r) {
+    cout << r.structure << "," << r.query_type << "," << r.pattern << "," << r.size << ","
+        << r.sparsity << "," << r.run << "," << r.queries << "," << r.build_threads << ","
+        << r.build_seconds << "," << r.bits_per_bit << "," << r.mean_ns << ","
+        << r.p50_ns << "," << r.p99_ns << "," << r.p999_ns << endl;
+}
+
+void print_json(const Row &r, bool first) {
+    cout << ((first) ? "[\n" : ",\n")
+        << "  {\"structure\": \"" << r.structure << "\", \"query_type\": \"" << r.query_type
+        << "\", \"pattern\": \"" << r.pattern << "\", \"size\": " << r.size
+        << ", \"sparsity\": " << r.sparsity << ", \"run\": " << r.run
+        << ", \"queries\": " << r.queries << ", \"build_threads\": " << r.build_threads
+        << ", \"build_seconds\": " << r.build_seconds << ", \"bits_per_bit\": " << r.bits_per_bit
+        << ", \"mean_ns\": " << r.mean_ns << ", \"p50_ns\": " << r.p50_ns
+        << ", \"p99_ns\": " << r.p99_ns << ", \"p999_ns\": " << r.p999_ns << "}";
+}
+
+struct Options {
+    std::vector<std::string> query_types = {"rank", "select"};
+    std::vector<size_t> sizes = {1ULL << 24};
+    std::vector<size_t> sparsities = {10, 50, 90};
+    std::vector<std::string> patterns;
+    std::vector<std::string> structures; // empty for all of orzo, orzo_interleaved, pasta_flat, poppy
+    std::string path; // raw bit vector file, see BitFile
+    std::string write_path; // generate sizes[0] at sparsities[0] into a file and exit
+    bool map = false; // query the file in place instead of loading it
+    size_t runs = 1;
+    size_t query_count = 1000000;
+    size_t seed = 1;
+    size_t threads = std::thread::hardware_concurrency();
+    bool json = false;
+};
+
+std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    for (size_t comma; (comma = list.find(',', start)) != std::string::npos; start = comma + 1) {
+        parts.push_back(list.substr(start, comma - start));
+    }
+    parts.push_back(list.substr(start));
+    return parts;
+}
+
+// a number or 2^k
+size_t parse_size(const std::string &s) {
+    return (s.starts_with("2^")) ? 1ULL << std::stoull(s.substr(2)) : std::stoull(s);
+}
+
+void sweep(const Options &opt) {
+    double ns_per_tick = tsc_ns_per_tick();
+    uint64_t overhead = tsc_overhead();
+    cerr << "rdtsc: " << ns_per_tick << " ns per tick, " << overhead << " ticks overhead" << endl;
+    bool first_row = true;
+    auto emit = [&](const Row &row) {
+        if (opt.json) {
+            print_json(row, first_row);
+        } else {
+            print_csv(row);
+        }
+        first_row = false;
+    };
+    if (!opt.json) {
+        print_csv_header();
+    }
+    // a file replaces the sweep over sizes and sparsities with its own bits
+    std::optional<BitFile> file;
+    if (!opt.path.empty()) {
+        file.emplace(opt.path);
+    }
+    auto wanted = [&](const std::string &name) {
+        return opt.structures.empty() || std::find(opt.structures.begin(), opt.structures.end(), name) != opt.structures.end();
+    };
+    bool with_pasta = wanted("pasta_flat") || wanted("poppy");
+    std::vector<size_t> sizes = (file) ? std::vector<size_t>{file->size()} : opt.sizes;
+    std::vector<size_t> sparsities = (file) ? std::vector<size_t>{0} : opt.sparsities;
+    for (size_t size : sizes) {
+        for (size_t sparsity : sparsities) {
+            for (size_t run = 1; run <= opt.runs; ++run) {
+                size_t seed = opt.seed + run - 1;
+                // a mapped file is queried in place, anything else is loaded
+                // into memory first
+                std::optional<OrzoBitvector<>> orzo_bv;
+                const uint64_t *bv;
+                size_t one_count = 0;
+                if (opt.map) {
+                    bv = file->data();
+                } else {
+                    orzo_bv.emplace(size, 5632);
+                    one_count = (file) ? file->copy_to(orzo_bv->data(), opt.threads)
+                        : fill_random_bits(orzo_bv->data(), size, sparsity, seed, opt.threads);
+                    bv = orzo_bv->data();
+                }
+                Row base{};
+                base.size = size;
+                base.run = run;
+                base.queries = opt.query_count;
+                // builds run before pinning, the orzo build threads inherit the mask
+                auto start = steady::now();
+                Orzo<> orzo(bv, size, opt.threads);
+                std::chrono::duration<double> orzo_build = steady::now() - start;
+                // the same index with its counters moved next to the bits
+                std::optional<InterleavedOrzo<>> interleaved;
+                std::chrono::duration<double> interleaved_build{};
+                if (wanted("orzo_interleaved")) {
+                    start = steady::now();
+                    interleaved.emplace(bv, size, opt.threads);
+                    interleaved_build = steady::now() - start;
+                }
+                if (opt.map) {
+                    one_count = orzo.get_one_count();
+                    file->advise(MADV_RANDOM);
+                }
+                if (file) {
+                    sparsity = measured_sparsity(one_count, size);
+                }
+                base.sparsity = sparsity;
+                cerr << "BV size " << size << ", sparsity " << sparsity << ", seed " << seed << endl;
+                std::optional<pasta::BitVector> pasta_bv;
+                std::optional<pasta::FlatRankSelect<>> pasta_flat;
+                std::optional<pasta::RankSelect<>> poppy;
+                std::chrono::duration<double> flat_build{}, poppy_build{};
+                if (with_pasta) {
+                    pasta_bv.emplace(size, 0);
+                    copy_words(pasta_bv->data().data(), bv, (size + 63) / 64, opt.threads);
+                    start = steady::now();
+                    pasta_flat.emplace(*pasta_bv);
+                    flat_build = steady::now() - start;
+                    start = steady::now();
+                    poppy.emplace(*pasta_bv);
+                    poppy_build = steady::now() - start;
+                }
+                set_affinity();
+                auto structure = [&](std::string name, double build_seconds, size_t build_threads, size_t space_bytes) {
+                    Row row = base;
+                    row.structure = name;
+                    row.build_seconds = build_seconds;
+                    row.build_threads = build_threads;
+                    row.bits_per_bit = 8.0 * (double) space_bytes / (double) size;
+                    return row;
+                };
+                Row orzo_row = structure("orzo", orzo_build.count(), opt.threads, orzo.space_usage());
+                // the slots hold the bits as well, only the rest is index
+                Row interleaved_row = (interleaved)
+                    ? structure("orzo_interleaved", interleaved_build.count(), opt.threads,
+                        interleaved->space_usage() - (((size + 63) / 64) * sizeof(uint64_t)))
+                    : Row{};
+                Row flat_row = (with_pasta) ? structure("pasta_flat", flat_build.count(), 1, pasta_flat->space_usage()) : Row{};
+                Row poppy_row = (with_pasta) ? structure("poppy", poppy_build.count(), 1, poppy->space_usage()) : Row{};
+                for (const std::string &query_type : opt.query_types) {
+                    bool do_rank = query_type == "rank";
+                    if (!do_rank && one_count == 0) {
+                        cerr << "no ones to select, skipping select" << endl;
+                        continue;
+                    }
+                    for (const auto &[pattern_name, pattern] : ACCESS_PATTERNS) {
+                        if (!opt.patterns.empty() && std::find(opt.patterns.begin(), opt.patterns.end(), pattern_name) == opt.patterns.end()) {
+                            continue;
+                        }
+                        std::vector<uint64_t> queries = (do_rank)
+                            ? make_queries(pattern, 0, size, opt.query_count, seed)
+                            : make_queries(pattern, 1, one_count, opt.query_count, seed);
+                        for (Row *row : {&orzo_row, &interleaved_row, &flat_row, &poppy_row}) {
+                            row->query_type = query_type;
+                            row->pattern = pattern_name;
+                        }
+                        if (do_rank) {
+                            if (wanted("orzo")) measure(orzo_row, [&](uint64_t i) { return orzo.rank1(bv, i); }, queries, ns_per_tick, overhead);
+                            if (interleaved) measure(interleaved_row, [&](uint64_t i) { return interleaved->rank1(bv, i); }, queries, ns_per_tick, overhead);
+                            if (wanted("pasta_flat")) measure(flat_row, [&](uint64_t i) { return pasta_flat->rank1(i); }, queries, ns_per_tick, overhead);
+                            if (wanted("poppy")) measure(poppy_row, [&](uint64_t i) { return poppy->rank1(i); }, queries, ns_per_tick, overhead);
+                        } else {
+                            if (wanted("orzo")) measure(orzo_row, [&](uint64_t i) { return orzo.select1(bv, i); }, queries, ns_per_tick, overhead);
+                            if (interleaved) measure(interleaved_row, [&](uint64_t i) { return interleaved->select1(bv, i); }, queries, ns_per_tick, overhead);
+                            if (wanted("pasta_flat")) measure(flat_row, [&](uint64_t i) { return pasta_flat->select1(i); }, queries, ns_per_tick, overhead);
+                            if (wanted("poppy")) measure(poppy_row, [&](uint64_t i) { return poppy->select1(i); }, queries, ns_per_tick, overhead);
+                        }
+#ifdef CHECK_CORRECTNESS
+                        // against pasta flat when it was built, otherwise rank
+                        // and select are checked against each other and the bits
+                        size_t incorrect_count = 0;
+                        for (uint64_t q : queries) {
+                            if (pasta_flat) {
+                                incorrect_count += (do_rank) ? orzo.rank1(bv, q) != pasta_flat->rank1(q)
+                                    : orzo.select1(bv, q) != pasta_flat->select1(q);
+                            } else if (do_rank) {
+                                uint64_t r = orzo.rank1(bv, q);
+                                bool set = (bv[q / 64] >> (q % 64)) & 1;
+                                incorrect_count += (set) ? orzo.select1(bv, r + 1) != q
+                                    : r != 0 && orzo.select1(bv, r) >= q;
+                            } else {
+                                uint64_t p = orzo.select1(bv, q);
+                                incorrect_count += p >= size || !((bv[p / 64] >> (p % 64)) & 1) || orzo.rank1(bv, p) != q - 1;
+                            }
+                            if (interleaved) {
+                                incorrect_count += (do_rank) ? interleaved->rank1(bv, q) != orzo.rank1(bv, q)
+                                    : interleaved->select1(bv, q) != orzo.select1(bv, q);
+                            }
+                        }
+                        cerr << ((incorrect_count == 0) ? "correct_" : "incorrect_") << "orzo_"
+                            << query_type << "_" << pattern_name << endl;
+#endif
+                        for (const Row *row : {&orzo_row, &interleaved_row, &flat_row, &poppy_row}) {
+                            if (wanted(row->structure) && !row->structure.empty()) emit(*row);
+                        }
+                    }
+                }
+                // let the next builds use every core again
+                set_affinity(0, true);
+            }
+        }
+    }
+    if (opt.json) {
+        cout << ((first_row) ? "[]" : "\n]") << endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+    for (int a = 1; a < argc; ++a) {
+        std::string arg(argv[a]);
+        if (arg == "--json") {
+            opt.json = true;
+            continue;
+        }
+        if (arg == "--map") {
+            opt.map = true;
+            continue;
+        }
+        if (a + 1 >= argc) {
+            cerr << "Usage: orzo-suite [--queries rank,select] [--sizes 2^24,2^26,...] "
+                "[--sparsities 10,50,90] [--patterns uniform,sequential,strided,zipf,sorted] "
+                "[--runs n] [--count queries per run] [--seed s] [--threads build threads] "
+                "[--structures orzo,orzo_interleaved,pasta_flat,poppy] [--file raw bit vector in place of sizes and sparsities] "
+                "[--map (query the file in place)] [--write file (generate one size and sparsity)] [--json]" << endl;
+            return -1;
+        }
+        std::string value(argv[++a]);
+        if (arg == "--queries") {
+            opt.query_types = split(value);
+        } else if (arg == "--sizes") {
+            opt.sizes.clear();
+            for (auto &s : split(value)) opt.sizes.push_back(parse_size(s));
+        } else if (arg == "--sparsities") {
+            opt.sparsities.clear();
+            for (auto &s : split(value)) opt.sparsities.push_back(std::stoull(s));
+        } else if (arg == "--patterns") {
+            opt.patterns = split(value);
+        } else if (arg == "--runs") {
+            opt.runs = std::stoull(value);
+        } else if (arg == "--count") {
+            opt.query_count = std::stoull(value);
+        } else if (arg == "--seed") {
+            opt.seed = std::stoull(value);
+        } else if (arg == "--structures") {
+            opt.structures = split(value);
+        } else if (arg == "--file") {
+            opt.path = value;
+        } else if (arg == "--write") {
+            opt.write_path = value;
+        } else if (arg == "--threads") {
+            opt.threads = std::max<size_t>(1, std::stoull(value));
+        } else {
+            cerr << "unknown option: " << arg << endl;
+            return -1;
+        }
+    }
+    if (!opt.write_path.empty()) {
+        size_t ones = write_random_bits(opt.write_path, opt.sizes[0], opt.sparsities[0], opt.seed, opt.threads);
+        cerr << "wrote " << opt.sizes[0] << " bits, " << ones << " ones, to " << opt.write_path << endl;
+        return 0;
+    }
+    if (opt.map && opt.path.empty()) {
+        cerr << "--map needs --file" << endl;
+        return -1;
+    }
+    sweep(opt);
+    return 0;
+}
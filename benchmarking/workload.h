@@ -0,0 +1,339 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+#include <bit>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <orzo/utils.h>
+
+/*
+ * Bit vectors and query streams for the benchmarks. Everything random is
+ * seeded by the caller, so a (seed, size, sparsity, pattern) tuple always
+ * produces the same workload, whatever the thread count.
+ */
+
+// the counter-th draw of the stream seed, splitmix64's output function applied
+// to seed + counter steps. any draw is computed without the ones before it,
+// so words can be generated in any order on any number of threads and still
+// come out the same for a seed
+inline uint64_t counter_random(uint64_t seed, uint64_t counter) {
+    uint64_t z = (seed * 0xD1B54A32D192ED03ULL) + ((counter + 1) * 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// words per parallel_for task in fill_random_bits and the copies below
+constexpr size_t WORKLOAD_CHUNK_WORDS = 1 << 14;
+
+/*
+ * Sets each bit of words [first_word, first_word + word_count) of an n bit
+ * vector with probability threshold / 65536, a word at a time on num_threads
+ * threads, words pointing at word first_word. Bit b of word w compares 16 bits
+ * of draw 16 * w + b / 4 against the threshold, so any slice of the vector
+ * comes out the same however it is cut. Returns the number of ones.
+ */
+inline size_t fill_random_words(
+    uint64_t *words,
+    size_t first_word,
+    size_t word_count,
+    size_t n,
+    uint64_t threshold,
+    uint64_t seed,
+    size_t num_threads
+) {
+    size_t last_word = (n + 63) / 64 - 1;
+    size_t chunk_count = (word_count + WORKLOAD_CHUNK_WORDS - 1) / WORKLOAD_CHUNK_WORDS;
+    std::vector<size_t> chunk_ones(chunk_count);
+    parallel_for(chunk_count, num_threads, [&](size_t chunk) {
+        size_t first = chunk * WORKLOAD_CHUNK_WORDS;
+        size_t last = std::min(word_count, first + WORKLOAD_CHUNK_WORDS);
+        size_t ones = 0;
+        for (size_t i = first; i < last; ++i) {
+            size_t w = first_word + i;
+            uint64_t word = 0;
+            for (size_t b = 0; b < 64; b += 4) {
+                uint64_t r = counter_random(seed, (16 * w) + (b / 4));
+                for (size_t s = 0; s < 4; ++s) {
+                    word |= (uint64_t) ((r >> (16 * s) & 0xFFFF) < threshold) << (b + s);
+                }
+            }
+            if (w == last_word && n % 64) {
+                word &= (1ULL << (n % 64)) - 1;
+            }
+            words[i] = word;
+            ones += std::popcount(word);
+        }
+        chunk_ones[chunk] = ones;
+    });
+    return std::accumulate(chunk_ones.begin(), chunk_ones.end(), (size_t) 0);
+}
+
+// the fill_random_words threshold of a sparsity (percent zeros)
+inline uint64_t sparsity_threshold(size_t sparsity) {
+    return (65536 * (100 - std::min<size_t>(sparsity, 100)) + 50) / 100;
+}
+
+/*
+ * Sets each of the first n bits with probability (100 - sparsity) / 100, as
+ * comparison.cc used to bit by bit, on num_threads threads. The result
+ * depends only on the seed. Returns the number of ones.
+ */
+inline size_t fill_random_bits(
+    uint64_t *words,
+    size_t n,
+    size_t sparsity,
+    uint64_t seed,
+    size_t num_threads = std::thread::hardware_concurrency()
+) {
+    return fill_random_words(words, 0, (n + 63) / 64, n, sparsity_threshold(sparsity), seed, num_threads);
+}
+
+// words generated per write in write_random_bits, 128 MiB
+constexpr size_t WORKLOAD_SLAB_WORDS = 1 << 24;
+
+/*
+ * Writes the n bits fill_random_bits would produce to path as a raw bit
+ * vector (see BitFile), a slab at a time, so vectors far larger than memory
+ * can be generated and later mapped. Returns the number of ones.
+ */
+inline size_t write_random_bits(
+    const std::string &path,
+    size_t n,
+    size_t sparsity,
+    uint64_t seed,
+    size_t num_threads = std::thread::hardware_concurrency()
+) {
+    FILE *out = fopen(path.c_str(), "wb");
+    if (out == nullptr) {
+        throw std::runtime_error("cannot open " + path + ": " + strerror(errno));
+    }
+    size_t word_count = (n + 63) / 64;
+    size_t byte_count = (n + 7) / 8;
+    std::vector<uint64_t> slab(std::min(word_count, WORKLOAD_SLAB_WORDS));
+    size_t ones = 0;
+    for (size_t first = 0; first < word_count; first += WORKLOAD_SLAB_WORDS) {
+        size_t count = std::min(word_count - first, WORKLOAD_SLAB_WORDS);
+        ones += fill_random_words(slab.data(), first, count, n, sparsity_threshold(sparsity), seed, num_threads);
+        // the last word is cut to the bytes holding bits below n
+        size_t bytes = std::min(count * 8, byte_count - (first * 8));
+        if (fwrite(slab.data(), 1, bytes, out) != bytes) {
+            fclose(out);
+            throw std::runtime_error("cannot write " + path + ": " + strerror(errno));
+        }
+    }
+    if (fclose(out) != 0) {
+        throw std::runtime_error("cannot write " + path + ": " + strerror(errno));
+    }
+    return ones;
+}
+
+// the sparsity (percent zeros, rounded) of a vector of n bits with one_count ones
+inline size_t measured_sparsity(size_t one_count, size_t n) {
+    return 100 - (((200 * one_count) + n) / (2 * n));
+}
+
+// memcpy of word_count words on num_threads threads (ex. into a pasta::BitVector)
+inline void copy_words(
+    uint64_t *dst,
+    const uint64_t *src,
+    size_t word_count,
+    size_t num_threads = std::thread::hardware_concurrency()
+) {
+    size_t chunk_count = (word_count + WORKLOAD_CHUNK_WORDS - 1) / WORKLOAD_CHUNK_WORDS;
+    parallel_for(chunk_count, num_threads, [&](size_t chunk) {
+        size_t first = chunk * WORKLOAD_CHUNK_WORDS;
+        size_t count = std::min(word_count - first, WORKLOAD_CHUNK_WORDS);
+        memcpy(dst + first, src + first, count * sizeof(uint64_t));
+    });
+}
+
+/*
+ * A raw bit vector file, mapped read-only. Bit i is bit i % 64 of the
+ * (i / 64)-th little endian 64 bit word, the layout of OrzoBitvector and
+ * pasta::BitVector in memory, so a vector written out with fwrite of its
+ * words loads back unchanged. A file of b bytes holds 8 * b bits.
+ */
+class BitFile {
+
+    private:
+
+        void *mapping = MAP_FAILED;
+        size_t byte_count = 0;
+
+    public:
+
+        explicit BitFile(const std::string &path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("cannot open " + path + ": " + strerror(errno));
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0) {
+                close(fd);
+                throw std::runtime_error("cannot read bits from empty or unreadable " + path);
+            }
+            this->byte_count = (size_t) st.st_size;
+            this->mapping = mmap(nullptr, this->byte_count, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (this->mapping == MAP_FAILED) {
+                throw std::runtime_error("cannot map " + path + ": " + strerror(errno));
+            }
+            madvise(this->mapping, this->byte_count, MADV_SEQUENTIAL);
+        }
+
+        BitFile(const BitFile&) = delete;
+        BitFile &operator=(const BitFile&) = delete;
+
+        ~BitFile() {
+            if (this->mapping != MAP_FAILED) {
+                munmap(this->mapping, this->byte_count);
+            }
+        }
+
+        size_t size() const { return this->byte_count * 8; }
+
+        /*
+         * The bits in place, for querying a file larger than memory without
+         * a copy. Past the end of the file the last page reads as zeros, and
+         * index kernels never read past the basic block holding the last bit,
+         * which is 64 byte aligned and so never crosses into an unmapped
+         * page. advice (ex. MADV_RANDOM once an index is built) is passed on
+         * to madvise.
+         */
+        const uint64_t *data() const { return (const uint64_t*) this->mapping; }
+        void advise(int advice) const { madvise(this->mapping, this->byte_count, advice); }
+
+        // copies the bits into words, which must hold size() bits, on
+        // num_threads threads, returns the number of ones
+        size_t copy_to(uint64_t *words, size_t num_threads = std::thread::hardware_concurrency()) const {
+            const char *bytes = (const char*) this->mapping;
+            size_t full_words = this->byte_count / 8;
+            size_t word_count = (this->byte_count + 7) / 8;
+            size_t chunk_count = (word_count + WORKLOAD_CHUNK_WORDS - 1) / WORKLOAD_CHUNK_WORDS;
+            std::vector<size_t> chunk_ones(chunk_count);
+            parallel_for(chunk_count, num_threads, [&](size_t chunk) {
+                size_t first = chunk * WORKLOAD_CHUNK_WORDS;
+                size_t last = std::min(full_words, first + WORKLOAD_CHUNK_WORDS);
+                size_t ones = 0;
+                if (first < last) {
+                    memcpy(words + first, bytes + (first * 8), (last - first) * 8);
+                    for (size_t w = first; w < last; ++w) {
+                        ones += std::popcount(words[w]);
+                    }
+                }
+                // a file not a multiple of 8 bytes ends in a partial word
+                if (full_words < word_count && first <= full_words && full_words < first + WORKLOAD_CHUNK_WORDS) {
+                    uint64_t tail = 0;
+                    memcpy(&tail, bytes + (full_words * 8), this->byte_count % 8);
+                    words[full_words] = tail;
+                    ones += std::popcount(tail);
+                }
+                chunk_ones[chunk] = ones;
+            });
+            return std::accumulate(chunk_ones.begin(), chunk_ones.end(), (size_t) 0);
+        }
+
+};
+
+enum class AccessPattern { uniform, sequential, strided, zipf, sorted };
+
+inline const std::vector<std::pair<std::string, AccessPattern>> ACCESS_PATTERNS = {
+    {"uniform", AccessPattern::uniform},
+    {"sequential", AccessPattern::sequential},
+    {"strided", AccessPattern::strided},
+    {"zipf", AccessPattern::zipf},
+    {"sorted", AccessPattern::sorted},
+};
+
+// uniform within a region, regions are picked with a Zipf law (ex. hot keys)
+constexpr size_t ZIPF_REGION = 1ULL << 16;
+constexpr double ZIPF_EXPONENT = 0.99;
+// uniform queries sorted within consecutive batches (ex. probing a sorted list)
+constexpr size_t SORTED_BATCH = 1024;
+
+/*
+ * count query arguments in [first, first + domain) following pattern, where
+ * domain is the bit vector size for rank (first = 0) and its number of ones
+ * (or zeros) for select (first = 1).
+ *  - uniform: independent uniform draws.
+ *  - sequential: consecutive arguments from a random start, wrapping around.
+ *  - strided: a random start advancing by domain / count + 1, so one pass
+ *    sweeps the whole vector while touching a new cache line on most queries.
+ *  - zipf: regions of ZIPF_REGION arguments ranked by a Zipf law, the ranks
+ *    shuffled over the vector so hot regions are not all at its start.
+ *  - sorted: uniform draws sorted within batches of SORTED_BATCH.
+ */
+inline std::vector<uint64_t> make_queries(
+    AccessPattern pattern,
+    uint64_t first,
+    uint64_t domain,
+    size_t count,
+    uint64_t seed
+) {
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<uint64_t> uniform(0, domain - 1);
+    std::vector<uint64_t> queries(count);
+    switch (pattern) {
+        case AccessPattern::uniform:
+        case AccessPattern::sorted: {
+            for (auto &q : queries) {
+                q = first + uniform(rng);
+            }
+            if (pattern == AccessPattern::sorted) {
+                for (size_t i = 0; i < count; i += SORTED_BATCH) {
+                    std::sort(queries.begin() + i, queries.begin() + std::min(count, i + SORTED_BATCH));
+                }
+            }
+            break;
+        }
+        case AccessPattern::sequential:
+        case AccessPattern::strided: {
+            uint64_t step = (pattern == AccessPattern::sequential) ? 1 : domain / count + 1;
+            uint64_t at = uniform(rng);
+            for (auto &q : queries) {
+                q = first + at;
+                at = (at + step) % domain;
+            }
+            break;
+        }
+        case AccessPattern::zipf: {
+            size_t region_count = (domain + ZIPF_REGION - 1) / ZIPF_REGION;
+            std::vector<double> cdf(region_count);
+            double total = 0;
+            for (size_t r = 0; r < region_count; ++r) {
+                total += 1.0 / std::pow((double) (r + 1), ZIPF_EXPONENT);
+                cdf[r] = total;
+            }
+            std::vector<uint64_t> region_of_rank(region_count);
+            std::iota(region_of_rank.begin(), region_of_rank.end(), 0);
+            std::shuffle(region_of_rank.begin(), region_of_rank.end(), rng);
+            std::uniform_real_distribution<double> unit(0.0, total);
+            for (auto &q : queries) {
+                size_t rank = std::lower_bound(cdf.begin(), cdf.end(), unit(rng)) - cdf.begin();
+                uint64_t region = region_of_rank[std::min(rank, region_count - 1)];
+                uint64_t start = region * ZIPF_REGION;
+                uint64_t width = std::min(ZIPF_REGION, domain - start);
+                q = first + start + rng() % width;
+            }
+            break;
+        }
+    }
+    return queries;
+}
+
+#endif /* WORKLOAD_H */
@@ -0,0 +1,166 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <bit>
+#include <new>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+/*
+ * Allocation policies for OrzoBitvector and the Orzo index arrays. A policy
+ * provides allocate(bytes), returning zeroed memory aligned to at least 64
+ * bytes, and deallocate(ptr, bytes), called with the size that was allocated.
+ * allocate throws std::bad_alloc rather than returning nullptr, since every
+ * caller writes through the pointer straight away.
+ * Policies are passed by value to the classes that use them and may carry
+ * state (ex. the NUMA node to bind to).
+ */
+
+inline size_t round_up(size_t bytes, size_t multiple) {
+    return ((bytes + multiple - 1) / multiple) * multiple;
+}
+
+class MallocAllocator {
+
+    public:
+
+        void *allocate(size_t bytes) {
+            // aligned_alloc wants a multiple of the alignment
+            size_t len = round_up(std::max<size_t>(bytes, 1), 64);
+            void *ptr = aligned_alloc(64, len);
+            if (!ptr) {
+                throw std::bad_alloc();
+            }
+            memset(ptr, 0, len);
+            return ptr;
+        }
+
+        void deallocate(void *ptr, size_t) {
+            free(ptr);
+        }
+
+};
+
+static constexpr size_t HUGE_PAGE_2M = 1ul << 21;
+static constexpr size_t HUGE_PAGE_1G = 1ul << 30;
+
+// maps len bytes aligned to 2 MiB and asks for transparent huge pages
+inline void *map_transparent_huge(size_t len) {
+    size_t padded = len + HUGE_PAGE_2M;
+    char *ptr = (char*) mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+    char *aligned = (char*) round_up((size_t) ptr, HUGE_PAGE_2M);
+    if (aligned != ptr) {
+        munmap(ptr, aligned - ptr);
+    }
+    size_t tail = (ptr + padded) - (aligned + len);
+    if (tail) {
+        munmap(aligned + len, tail);
+    }
+    madvise(aligned, len, MADV_HUGEPAGE);
+    return aligned;
+}
+
+/*
+ * Backs allocations with PAGE_SIZE pages so a single TLB entry covers 2 MiB or
+ * 1 GiB of the bit vector or l1l2 rather than 4 KiB. Explicit hugetlbfs pages
+ * (MAP_HUGETLB) are used when the system has them reserved, otherwise this
+ * falls back to transparent huge pages, which are only ever 2 MiB. Allocations
+ * smaller than a huge page (ex. l0) go to malloc rather than waste a page.
+ */
+template<size_t PAGE_SIZE = HUGE_PAGE_2M>
+class HugePageAllocator {
+
+    static_assert(PAGE_SIZE == HUGE_PAGE_2M || PAGE_SIZE == HUGE_PAGE_1G);
+
+    public:
+
+        void *allocate(size_t bytes) {
+            if (bytes < PAGE_SIZE) {
+                return MallocAllocator().allocate(bytes);
+            }
+            size_t len = round_up(bytes, PAGE_SIZE);
+            int page_flag = std::countr_zero(PAGE_SIZE) << MAP_HUGE_SHIFT;
+            void *ptr = mmap(
+                nullptr, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | page_flag, -1, 0
+            );
+            if (ptr == MAP_FAILED) {
+                ptr = map_transparent_huge(len);
+            }
+            if (!ptr) {
+                throw std::bad_alloc();
+            }
+            return ptr;
+        }
+
+        void deallocate(void *ptr, size_t bytes) {
+            if (bytes < PAGE_SIZE) {
+                MallocAllocator().deallocate(ptr, bytes);
+                return;
+            }
+            munmap(ptr, round_up(bytes, PAGE_SIZE));
+        }
+
+};
+
+static constexpr int NUMA_INTERLEAVE = -1;
+
+/*
+ * Places allocations on one NUMA node (MPOL_BIND), or spreads their pages
+ * round robin over every node this process may use (MPOL_INTERLEAVE, the
+ * default), which evens out memory bandwidth when all sockets query one
+ * index. The policy is set with the mbind syscall before the pages are first
+ * touched, so no libnuma is needed. Optionally uses transparent huge pages.
+ */
+class NumaAllocator {
+
+    private:
+
+        int node;
+        bool huge_pages;
+
+    public:
+
+        NumaAllocator(int node = NUMA_INTERLEAVE, bool huge_pages = true)
+            : node(node), huge_pages(huge_pages) {}
+
+        void *allocate(size_t bytes) {
+            size_t len = round_up(std::max<size_t>(bytes, 1), HUGE_PAGE_2M);
+            void *ptr = (this->huge_pages) ? map_transparent_huge(len) : nullptr;
+            if (!ptr) {
+                ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            }
+            if (ptr == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            constexpr unsigned long max_node = 1024;
+            unsigned long node_mask[max_node / 64] = {0};
+            int mode = MPOL_BIND;
+            if (this->node == NUMA_INTERLEAVE) {
+                mode = MPOL_INTERLEAVE;
+                syscall(SYS_get_mempolicy, nullptr, node_mask, max_node, nullptr, MPOL_F_MEMS_ALLOWED);
+            } else {
+                node_mask[this->node / 64] = 1ul << (this->node % 64);
+            }
+            // on failure (ex. no NUMA support) the memory is still usable, just
+            // placed by the default policy
+            syscall(SYS_mbind, ptr, len, mode, node_mask, max_node, 0);
+            return ptr;
+        }
+
+        void deallocate(void *ptr, size_t bytes) {
+            munmap(ptr, round_up(std::max<size_t>(bytes, 1), HUGE_PAGE_2M));
+        }
+
+};
+
+#endif /* ALLOCATOR_H */
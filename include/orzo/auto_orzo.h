@@ -0,0 +1,103 @@
+#ifndef AUTO_ORZO_H
+#define AUTO_ORZO_H
+
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+#include <variant>
+#include <vector>
+#include "orzo.h"
+#include "elias_fano.h"
+
+/*
+ * Picks the backend for a bit vector from its density at build time: the ones
+ * are counted first, and if an EliasFanoOrzo of them is estimated to take at
+ * most 1 / SPARSE_SPACE_RATIO of the space of the bit vector plus an Orzo
+ * index, that is built instead. Elias-fano is the smaller of the two up to a
+ * density of around 1/5, but its rank is slower than Orzo's well before that
+ * (its select stays faster), so it is only picked where it is clearly smaller,
+ * below a density of around 1/10. Queries dispatch on the backend that was
+ * built. When sparse() is true the bit vector passed to the queries is never
+ * read and may be freed.
+ */
+template<typename Allocator = MallocAllocator>
+class AutoOrzo {
+
+    public:
+
+        using Dense = Orzo<512, 128, 10, true, true, false, Allocator>;
+        using Sparse = EliasFanoOrzo<Allocator>;
+
+    private:
+
+        static constexpr uint64_t SPARSE_SPACE_RATIO = 2;
+
+        uint64_t bv_count;
+        // monostate only until the constructor has picked
+        std::variant<std::monostate, Dense, Sparse> index;
+
+    public:
+
+        AutoOrzo(
+            const uint64_t *bv,
+            size_t bv_count,
+            size_t num_threads = std::thread::hardware_concurrency(),
+            Allocator allocator = Allocator()
+        ) : bv_count(bv_count) {
+            constexpr uint64_t CHUNK_COUNT = 1ul << 20;
+            size_t num_chunks = (bv_count + CHUNK_COUNT - 1) / CHUNK_COUNT;
+            std::vector<uint64_t> counts(num_chunks);
+            parallel_for(num_chunks, num_threads, [&](size_t chunk) {
+                uint64_t bits = std::min<uint64_t>(bv_count - (chunk * CHUNK_COUNT), CHUNK_COUNT);
+                counts[chunk] = popcount_prefix(&(bv[chunk * (CHUNK_COUNT / 64)]), bits);
+            });
+            uint64_t one_count = 0;
+            for (uint64_t count : counts) {
+                one_count += count;
+            }
+            uint64_t sparse_bytes = Sparse::space_estimate(bv_count, one_count);
+            if ((sparse_bytes * SPARSE_SPACE_RATIO) <= Dense::space_estimate(bv_count, one_count)) {
+                this->index.template emplace<Sparse>(bv, bv_count, num_threads, allocator);
+            } else {
+                this->index.template emplace<Dense>(bv, bv_count, num_threads, allocator);
+            }
+        }
+
+        bool sparse() const { return std::holds_alternative<Sparse>(this->index); }
+
+        uint64_t get_one_count() const {
+            if (const Sparse *idx = std::get_if<Sparse>(&(this->index))) {
+                return idx->get_one_count();
+            }
+            return std::get<Dense>(this->index).get_one_count();
+        }
+
+        // bytes of the index, and of the bit vector only if it is still read
+        uint64_t space_usage() const {
+            if (const Sparse *idx = std::get_if<Sparse>(&(this->index))) {
+                return idx->space_usage();
+            }
+            return std::get<Dense>(this->index).space_usage() + ((this->bv_count + 7) / 8);
+        }
+
+        uint64_t rank1(const uint64_t *bv, uint64_t i) const {
+            if (const Sparse *idx = std::get_if<Sparse>(&(this->index))) {
+                return idx->rank1(bv, i);
+            }
+            return std::get<Dense>(this->index).rank1(bv, i);
+        }
+
+        uint64_t rank0(const uint64_t *bv, uint64_t i) const {
+            return i - this->rank1(bv, i);
+        }
+
+        uint64_t select1(const uint64_t *bv, uint64_t i) const {
+            if (const Sparse *idx = std::get_if<Sparse>(&(this->index))) {
+                return idx->select1(bv, i);
+            }
+            return std::get<Dense>(this->index).select1(bv, i);
+        }
+
+};
+
+#endif /* AUTO_ORZO_H */
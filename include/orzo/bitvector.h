@@ -4,28 +4,35 @@
 #include <cassert>
 #include <iostream>
 #include <cstring>
+#include <utility>
+#include "allocator.h"
 
 using std::cout, std::endl;
 
+template<typename Allocator = MallocAllocator>
 class OrzoBitvector {
 
     private:
 
         uint64_t *bv;
+        uint64_t num_words;
+        Allocator allocator;
 
     public:
 
+        // memory comes zeroed and at least 64 byte aligned from allocator
         OrzoBitvector(
             uint64_t n,
             uint64_t multiple_of, // in bits
-            uint64_t alignment = 64
-        ) {
+            Allocator allocator = Allocator()
+        ) : allocator(allocator) {
             uint64_t *bv;
-            uint64_t num_words = n / 64;
             uint64_t mow = multiple_of / 64; // multiple of in words
-            num_words += (num_words % mow);
-            bv = (uint64_t*) aligned_alloc(alignment, num_words * sizeof(*bv));
-            memset(bv, 0, num_words * sizeof(*bv));
+            // round up to a whole number of multiple_of sized blocks, the index
+            // kernels read whole basic blocks
+            uint64_t num_words = (((n + 63) / 64 + mow - 1) / mow) * mow;
+            bv = (uint64_t*) this->allocator.allocate(num_words * sizeof(*bv));
+            this->num_words = num_words;
 #ifdef DEBUG
             bool divisible = (((uint64_t) bv) % 64) == 0;
             cout << "bv"
@@ -35,22 +42,36 @@ class OrzoBitvector {
             this->bv = bv;
         }
 
+        OrzoBitvector(const OrzoBitvector&) = delete;
+        OrzoBitvector &operator=(const OrzoBitvector&) = delete;
+
+        OrzoBitvector(OrzoBitvector &&other) noexcept
+            : bv(std::exchange(other.bv, nullptr)),
+              num_words(std::exchange(other.num_words, 0)),
+              allocator(other.allocator) {}
+
         ~OrzoBitvector() {
-            free(this->bv);
+            if (this->bv) {
+                this->allocator.deallocate(this->bv, this->num_words * sizeof(*this->bv));
+            }
         }
 
         uint64_t *data() {
             return this->bv;
         }
 
+        const uint64_t *data() const {
+            return this->bv;
+        }
+
         void set_bit(uint64_t i) {
             uint64_t word_idx = i / 64;
             this->bv[word_idx] |= (1ul << (i % 64));
         }
 
-        bool get_bit(uint64_t i) {
+        bool get_bit(uint64_t i) const {
             uint64_t word_idx = i / 64;
-            return (bool) (this->bv[word_idx] & (1 << (i % 64)));
+            return (bool) (this->bv[word_idx] & (1ul << (i % 64)));
         }
 
 };
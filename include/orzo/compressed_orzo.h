@@ -0,0 +1,297 @@
+#ifndef COMPRESSED_ORZO_H
+#define COMPRESSED_ORZO_H
+
+#include <cstdint>
+#include <algorithm>
+#include <bit>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <immintrin.h>
+#include "orzo.h"
+
+/*
+ * An Orzo index over a bit vector whose basic blocks are stored compressed,
+ * each in one of three ways:
+ *
+ * - fill: a block of all zeros or all ones, which takes no words at all
+ * - runs: a block with few runs, stored as 16 bit fields, the number of
+ *   transitions (with the value of the first bit in the top bit) followed by
+ *   the position of each transition, used while fewer words than raw
+ * - raw: the BASIC_BLOCK_WORDS words of the block as they are
+ *
+ * The l0 and l1l2 index is exactly Orzo's, built from the uncompressed bit
+ * vector, which can be freed once the constructor returns. Alongside it, each
+ * lower block has a 128 bit descriptor locating its basic blocks in payload:
+ *
+ * [ payload word offset | fill is ones: bb N_L2 ... bb 0 | word offset in lower block: bb N_L2 ... bb 1 ]
+ *
+ * The size of a basic block is the distance to the next one's offset, which
+ * tells the three kinds apart (0 words for fill, BASIC_BLOCK_WORDS for raw).
+ * Queries go through the index as usual and then decode only their basic
+ * block, at the cost of a descriptor load that raw Orzo does not have.
+ */
+template<
+    uint64_t BASIC_BLOCK_COUNT = 512,
+    uint64_t L1L2_COUNT = 128,
+    uint64_t N_L2 = 10,
+    bool use_l0 = true,
+    bool support_select = true,
+    bool support_select0 = false,
+    typename Allocator = MallocAllocator
+>
+class CompressedOrzo : protected Orzo<BASIC_BLOCK_COUNT, L1L2_COUNT, N_L2, use_l0, support_select, support_select0, Allocator> {
+
+    private:
+
+        using Base = Orzo<BASIC_BLOCK_COUNT, L1L2_COUNT, N_L2, use_l0, support_select, support_select0, Allocator>;
+
+        static constexpr uint64_t BASIC_PER_LOWER = N_L2 + 1;
+        // bits of the offset of a basic block within its lower block
+        static constexpr uint64_t BB_OFFSET_COUNT = std::bit_width(N_L2 * Base::BASIC_BLOCK_WORDS);
+        static constexpr uint64_t BB_OFFSET_MASK = (1ul << BB_OFFSET_COUNT) - 1;
+        static constexpr uint64_t FILL_SHIFT = N_L2 * BB_OFFSET_COUNT;
+        static constexpr uint64_t PAYLOAD_OFFSET_SHIFT = FILL_SHIFT + BASIC_PER_LOWER;
+        // the most transitions a runs block can hold while smaller than raw
+        static constexpr uint64_t MAX_TRANSITIONS = (4 * Base::BASIC_BLOCK_WORDS) - 5;
+
+        static_assert((128 - PAYLOAD_OFFSET_SHIFT) >= 32,
+            "no room left in a descriptor for the payload offset");
+        static_assert(BASIC_BLOCK_COUNT < (1ul << 15),
+            "runs positions and counts are 15 bit");
+
+        __uint128_t *descriptors = nullptr; // one per lower block, and one past the last
+        uint64_t *payload = nullptr;
+        uint64_t payload_count = 0; // in words
+
+        // shifted copy of each word with the bit before it, so set bits of
+        // word ^ shifted are transitions. the first bit of the block is never one
+        template<typename F>
+        static void for_each_transition(const uint64_t *words, F f) {
+            uint64_t prev = words[0] & 1;
+            for (uint64_t w = 0; w < Base::BASIC_BLOCK_WORDS; ++w) {
+                uint64_t diff = words[w] ^ ((words[w] << 1) | prev);
+                prev = words[w] >> 63;
+                for (; diff; diff &= diff - 1) {
+                    f((w * 64) + std::countr_zero(diff));
+                }
+            }
+        }
+
+        static uint64_t transition_count(const uint64_t *words) {
+            uint64_t count = 0;
+            uint64_t prev = words[0] & 1;
+            for (uint64_t w = 0; w < Base::BASIC_BLOCK_WORDS; ++w) {
+                count += (uint64_t) std::popcount(words[w] ^ ((words[w] << 1) | prev));
+                prev = words[w] >> 63;
+            }
+            return count;
+        }
+
+        // words the basic block at words takes in payload
+        static uint64_t compressed_words(const uint64_t *words) {
+            uint64_t count = transition_count(words);
+            if (count == 0) {
+                return 0;
+            }
+            return (count <= MAX_TRANSITIONS) ? ((count + 4) / 4) : Base::BASIC_BLOCK_WORDS;
+        }
+
+        // fills the payload and descriptor of lower block l1l2_idx, whose
+        // payload starts at word payload_offset
+        void compress_lower(const uint64_t *bv, size_t l1l2_idx, size_t num_basic_blocks, uint64_t payload_offset) {
+            __uint128_t descriptor = (__uint128_t) payload_offset << PAYLOAD_OFFSET_SHIFT;
+            uint64_t offset = 0;
+            for (uint64_t k = 0; k < BASIC_PER_LOWER; ++k) {
+                if (k) {
+                    descriptor |= (__uint128_t) offset << ((k - 1) * BB_OFFSET_COUNT);
+                }
+                size_t bb = (l1l2_idx * BASIC_PER_LOWER) + k;
+                if (bb >= num_basic_blocks) {
+                    continue;
+                }
+                const uint64_t *words = &(bv[bb * Base::BASIC_BLOCK_WORDS]);
+                uint64_t size = compressed_words(words);
+                uint64_t *out = &(this->payload[payload_offset + offset]);
+                if (size == 0) {
+                    descriptor |= (__uint128_t) (words[0] & 1) << (FILL_SHIFT + k);
+                } else if (size == Base::BASIC_BLOCK_WORDS) {
+                    std::copy(words, words + Base::BASIC_BLOCK_WORDS, out);
+                } else {
+                    uint16_t *runs = (uint16_t*) out;
+                    uint64_t count = 0;
+                    for_each_transition(words, [&](uint64_t position) {
+                        runs[++count] = (uint16_t) position;
+                    });
+                    runs[0] = (uint16_t) (count | ((words[0] & 1) << 15));
+                }
+                offset += size;
+            }
+            this->descriptors[l1l2_idx] = descriptor;
+        }
+
+        // payload of basic block bb and its size in words, fill is set to the
+        // value of a fill block
+        const uint64_t *locate(uint64_t bb, uint64_t &size, bool &fill) const {
+            uint64_t l1l2_idx = bb / BASIC_PER_LOWER;
+            uint64_t k = bb % BASIC_PER_LOWER;
+            __uint128_t descriptor = this->descriptors[l1l2_idx];
+            uint64_t payload_offset = (uint64_t) (descriptor >> PAYLOAD_OFFSET_SHIFT);
+            uint64_t offset = (k) ? (uint64_t) (descriptor >> ((k - 1) * BB_OFFSET_COUNT)) & BB_OFFSET_MASK : 0;
+            uint64_t next = (k < N_L2)
+                ? (uint64_t) (descriptor >> (k * BB_OFFSET_COUNT)) & BB_OFFSET_MASK
+                : (uint64_t) (this->descriptors[l1l2_idx + 1] >> PAYLOAD_OFFSET_SHIFT) - payload_offset;
+            size = next - offset;
+            fill = (descriptor >> (FILL_SHIFT + k)) & 1;
+            return &(this->payload[payload_offset + offset]);
+        }
+
+        // ones before position j of basic block bb
+        uint64_t rank_in_block(uint64_t bb, uint64_t j) const {
+            uint64_t size;
+            bool fill;
+            const uint64_t *words = this->locate(bb, size, fill);
+            if (size == 0) {
+                return (fill) ? j : 0;
+            }
+            if (size == Base::BASIC_BLOCK_WORDS) {
+                return popcount_prefix(words, j);
+            }
+            const uint16_t *runs = (const uint16_t*) words;
+            uint64_t count = runs[0] & 0x7fff;
+            uint64_t value = runs[0] >> 15;
+            uint64_t start = 0;
+            uint64_t rank = 0;
+            for (uint64_t t = 1; t <= count && runs[t] < j; ++t) {
+                rank += value * (runs[t] - start);
+                start = runs[t];
+                value ^= 1;
+            }
+            return rank + (value * (j - start));
+        }
+
+        // position within basic block bb of its rank-th one (zero if zeros),
+        // rank is 1-based
+        template<bool zeros>
+        uint64_t select_in_block(uint64_t bb, uint64_t rank) const {
+            uint64_t size;
+            bool fill;
+            const uint64_t *words = this->locate(bb, size, fill);
+            if (size == 0) {
+                return rank - 1;
+            }
+            if (size == Base::BASIC_BLOCK_WORDS) {
+                if constexpr(zeros) {
+                    return Base::select0_in_block(words, 0, rank);
+                } else {
+                    return Base::select1_in_block(words, 0, rank);
+                }
+            }
+            const uint16_t *runs = (const uint16_t*) words;
+            uint64_t count = runs[0] & 0x7fff;
+            // value of the current run is whether it holds the bits looked for
+            uint64_t value = (runs[0] >> 15) ^ (uint64_t) zeros;
+            uint64_t start = 0;
+            for (uint64_t t = 1; t <= count; ++t) {
+                uint64_t length = runs[t] - start;
+                if (value && (rank <= length)) {
+                    break;
+                }
+                rank -= value * length;
+                start = runs[t];
+                value ^= 1;
+            }
+            return start + rank - 1;
+        }
+
+    public:
+
+        /*
+         * Builds the Orzo index from the uncompressed bv, then the payload in
+         * two passes over the upper blocks in parallel, the first for the size
+         * of each lower block's payload, the second to write it once a prefix
+         * sum has placed every lower block. Like Orzo, bv is read in whole
+         * basic blocks.
+         */
+        CompressedOrzo(
+            const uint64_t *bv,
+            size_t bv_count,
+            size_t num_threads = std::thread::hardware_concurrency(),
+            Allocator allocator = Allocator()
+        ) : Base(bv, bv_count, num_threads, allocator) {
+            size_t num_lower_blocks = this->L1L2_INDEX_COUNT;
+            size_t num_basic_blocks = (bv_count + BASIC_BLOCK_COUNT - 1) / BASIC_BLOCK_COUNT;
+            size_t l0_count = (num_lower_blocks + this->LOWER_PER_UPPER - 1) / this->LOWER_PER_UPPER;
+            // payload_offsets[l + 1] first holds the payload words of lower block l alone
+            std::vector<uint64_t> payload_offsets(num_lower_blocks + 1, 0);
+            parallel_for(l0_count, num_threads, [&](size_t upper_idx) {
+                size_t first = upper_idx * this->LOWER_PER_UPPER;
+                size_t last = std::min<size_t>(first + this->LOWER_PER_UPPER, num_lower_blocks);
+                for (size_t bb = first * BASIC_PER_LOWER; bb < std::min<size_t>(last * BASIC_PER_LOWER, num_basic_blocks); ++bb) {
+                    payload_offsets[(bb / BASIC_PER_LOWER) + 1] += compressed_words(&(bv[bb * Base::BASIC_BLOCK_WORDS]));
+                }
+            });
+            for (size_t l = 1; l <= num_lower_blocks; ++l) {
+                payload_offsets[l] += payload_offsets[l - 1];
+            }
+            this->payload_count = payload_offsets[num_lower_blocks];
+            this->descriptors = this->template allocate_array<__uint128_t>(num_lower_blocks + 1);
+            this->payload = this->template allocate_array<uint64_t>(this->payload_count);
+            parallel_for(l0_count, num_threads, [&](size_t upper_idx) {
+                size_t first = upper_idx * this->LOWER_PER_UPPER;
+                size_t last = std::min<size_t>(first + this->LOWER_PER_UPPER, num_lower_blocks);
+                for (size_t l1l2_idx = first; l1l2_idx < last; ++l1l2_idx) {
+                    this->compress_lower(bv, l1l2_idx, num_basic_blocks, payload_offsets[l1l2_idx]);
+                }
+            });
+            this->descriptors[num_lower_blocks] = (__uint128_t) this->payload_count << PAYLOAD_OFFSET_SHIFT;
+        }
+
+        CompressedOrzo(CompressedOrzo &&other) noexcept
+            : Base(std::move(other)),
+              descriptors(std::exchange(other.descriptors, nullptr)),
+              payload(std::exchange(other.payload, nullptr)),
+              payload_count(other.payload_count) {}
+
+        ~CompressedOrzo() {
+            this->deallocate_array(this->descriptors, this->L1L2_INDEX_COUNT + 1);
+            this->deallocate_array(this->payload, this->payload_count);
+        }
+
+        using Base::get_one_count;
+
+        // bytes of the index, descriptors and payload, all there is to keep
+        uint64_t space_usage() const {
+            return Base::space_usage() + ((this->L1L2_INDEX_COUNT + 1) * sizeof(__uint128_t))
+                + (this->payload_count * sizeof(uint64_t));
+        }
+
+        // the queries take bv like Orzo's but never read it
+        uint64_t rank1(const uint64_t *bv, uint64_t i) const {
+            return this->basic_block_rank(i) + this->rank_in_block(i / BASIC_BLOCK_COUNT, i % BASIC_BLOCK_COUNT);
+        }
+
+        uint64_t rank0(const uint64_t *bv, uint64_t i) const {
+            return i - this->rank1(bv, i);
+        }
+
+        uint64_t select1(const uint64_t *bv, uint64_t i) const {
+            uint64_t limit;
+            uint64_t l1l2_idx = this->select_sample(i, limit);
+            uint64_t rank;
+            uint64_t bb = this->select1_basic_block(i, l1l2_idx, limit, rank) / Base::BASIC_BLOCK_WORDS;
+            return (bb * BASIC_BLOCK_COUNT) + this->template select_in_block<false>(bb, rank);
+        }
+
+        uint64_t select0(const uint64_t *bv, uint64_t i) const {
+            static_assert(support_select0, "select0 needs support_select0");
+            uint64_t limit;
+            uint64_t l1l2_idx = this->template select_sample<true>(i, limit);
+            uint64_t rank;
+            uint64_t bb = this->select0_basic_block(i, l1l2_idx, limit, rank) / Base::BASIC_BLOCK_WORDS;
+            return (bb * BASIC_BLOCK_COUNT) + this->template select_in_block<true>(bb, rank);
+        }
+
+};
+
+#endif /* COMPRESSED_ORZO_H */
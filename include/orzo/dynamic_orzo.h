@@ -0,0 +1,255 @@
+#ifndef DYNAMIC_ORZO_H
+#define DYNAMIC_ORZO_H
+
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "orzo.h"
+
+/*
+ * An Orzo index that stays valid while bits of the bit vector are set and
+ * cleared through it. An update touches only what its count feeds into: the
+ * l1l2 entry of its lower block is decoded and re-encoded with its L2s
+ * adjusted, and the l1 counts of the later lower blocks in the same upper
+ * block are bumped, at most LOWER_PER_UPPER - 1 entries. l0 is not touched
+ * right away; the change is recorded as a per upper block delta, which the
+ * next query applies in a single prefix pass over l0 from the first changed
+ * upper block, so a batch of updates pays for propagation once.
+ *
+ * The select samples are left as they are. Every update shifts the rank of
+ * every later one (zero) by one, so keeping them exact would mean placing
+ * every later sample again. Instead, after d <= SELECT_SAMPLE updates, the
+ * one a sample was placed for has moved by at most d ranks, so the right
+ * lower block for rank i still lies between the samples one before and one
+ * after i's own, and select_slack widens select's window to those. Past
+ * SELECT_SAMPLE updates the next select (or an explicit flush()) places the
+ * samples again from the first upper block changed since, which costs a
+ * pass over the rest of the vector at most once per SELECT_SAMPLE updates.
+ * rank never reads the samples and never waits for them.
+ *
+ * Queries must go through DynamicOrzo rather than an Orzo reference to it,
+ * since they are what flush pending updates.
+ */
+template<
+    uint64_t BASIC_BLOCK_COUNT = 512,
+    uint64_t L1L2_COUNT = 128,
+    uint64_t N_L2 = 10,
+    bool use_l0 = true,
+    bool support_select = true,
+    bool support_select0 = false,
+    typename Allocator = MallocAllocator
+>
+class DynamicOrzo : public Orzo<BASIC_BLOCK_COUNT, L1L2_COUNT, N_L2, use_l0, support_select, support_select0, Allocator> {
+
+    private:
+
+        using Base = Orzo<BASIC_BLOCK_COUNT, L1L2_COUNT, N_L2, use_l0, support_select, support_select0, Allocator>;
+
+        // change in the count of upper block u not yet added to l0[u + 1 ...]
+        std::vector<int64_t> l0_deltas;
+        // first upper block with a pending delta, l0 entries before it are
+        // current
+        size_t first_dirty_upper;
+        bool dirty = false;
+        // updates since the select samples were placed, and the first upper
+        // block they changed, samples before it are exact
+        uint64_t sample_drift = 0;
+        size_t first_stale_upper;
+
+        void update(uint64_t i, int64_t delta) {
+            assert(i < this->bv_count);
+            uint64_t l1l2_idx = i / Base::LOWER_BLOCK_COUNT;
+            __uint128_t entry = this->l1l2[l1l2_idx];
+            // L2 k counts up to the end of basic block k, so every one from
+            // the basic block holding i onwards moves
+            uint64_t l2_counts[N_L2];
+            for (uint64_t k = 0; k < N_L2; ++k) {
+                l2_counts[k] = this->decode_l2(entry, k);
+            }
+            uint64_t iob = (i % Base::LOWER_BLOCK_COUNT) / BASIC_BLOCK_COUNT;
+            for (uint64_t k = iob; k < N_L2; ++k) {
+                l2_counts[k] += delta;
+            }
+            __uint128_t l1 = (entry >> Base::EF_TOTAL_COUNT) << Base::EF_TOTAL_COUNT;
+            this->l1l2[l1l2_idx] = l1 | this->elias_fano_encode(l2_counts);
+            // l1 counts restart at every upper block, so only lower blocks up
+            // to its end move
+            uint64_t upper_idx = l1l2_idx / this->LOWER_PER_UPPER;
+            uint64_t end = std::min<uint64_t>(this->L1L2_INDEX_COUNT, (upper_idx + 1) * this->LOWER_PER_UPPER);
+            __uint128_t l1_one = (__uint128_t) 1 << Base::EF_TOTAL_COUNT;
+            for (uint64_t idx = l1l2_idx + 1; idx < end; ++idx) {
+                this->l1l2[idx] = (delta > 0) ? (this->l1l2[idx] + l1_one) : (this->l1l2[idx] - l1_one);
+            }
+            this->l0_deltas[upper_idx] += delta;
+            this->first_dirty_upper = std::min<size_t>(this->first_dirty_upper, upper_idx);
+            this->dirty = true;
+            if constexpr(support_select || support_select0) {
+                ++this->sample_drift;
+                this->first_stale_upper = std::min<size_t>(this->first_stale_upper, upper_idx);
+                this->select_slack = 1;
+            }
+        }
+
+        // applies pending updates to l0, all rank needs
+        void flush_l0() {
+            if (!this->dirty) {
+                return;
+            }
+            size_t l0_count = this->l0_deltas.size();
+            size_t first_upper = std::exchange(this->first_dirty_upper, l0_count);
+            int64_t carry = 0;
+            for (size_t u = first_upper; u < l0_count; ++u) {
+                carry += std::exchange(this->l0_deltas[u], 0);
+                this->l0[u + 1] += carry;
+            }
+            this->one_count = this->l0[l0_count];
+            this->dirty = false;
+        }
+
+        // applies pending updates to l0, and places the select samples again
+        // if they drifted further than select_slack covers, or if exact
+        void flush_select(bool exact) {
+            this->flush_l0();
+            if ((this->sample_drift == 0) || (!exact && (this->sample_drift <= Base::SELECT_SAMPLE))) {
+                return;
+            }
+            size_t first_upper = std::exchange(this->first_stale_upper, this->l0_deltas.size());
+            if constexpr(support_select) {
+                this->update_select<false>(first_upper);
+            }
+            if constexpr(support_select0) {
+                this->update_select<true>(first_upper);
+            }
+            this->sample_drift = 0;
+            this->select_slack = 0;
+        }
+
+        // places the samples of the ones (zeros) of upper blocks first_upper
+        // onwards again, in an array resized first if the number of samples
+        // changed. this only reads l0 and l1
+        template<bool zeros>
+        void update_select(size_t first_upper) {
+            uint32_t *&samples = (zeros) ? this->select0_samples : this->select_samples;
+            uint64_t &sample_count = (zeros) ? this->SELECT0_SAMPLE_COUNT : this->SELECT_SAMPLE_COUNT;
+            uint64_t total = (zeros) ? (this->bv_count - this->one_count) : this->one_count;
+            uint64_t new_count = Base::select_sample_count(total);
+            if (new_count != sample_count) {
+                uint32_t *resized = this->template allocate_array<uint32_t>(new_count);
+                std::copy(samples, samples + std::min(sample_count, new_count), resized);
+                this->deallocate_array(samples, sample_count);
+                samples = resized;
+                sample_count = new_count;
+            }
+            for (size_t u = first_upper; u < this->l0_deltas.size(); ++u) {
+                this->template build_select_samples<zeros>(u);
+            }
+        }
+
+    public:
+
+        DynamicOrzo(
+            uint64_t *bv,
+            size_t bv_count,
+            size_t num_threads = std::thread::hardware_concurrency(),
+            Allocator allocator = Allocator()
+        ) : Base(bv, bv_count, num_threads, allocator) {
+            size_t l0_count = (bv_count + this->UPPER_BLOCK_COUNT - 1) / this->UPPER_BLOCK_COUNT;
+            this->l0_deltas.assign(l0_count, 0);
+            this->first_dirty_upper = l0_count;
+            this->first_stale_upper = l0_count;
+        }
+
+        // return whether bit i changed, bv must be the bit vector indexed
+        bool set_bit(uint64_t *bv, uint64_t i) {
+            uint64_t mask = 1ul << (i % 64);
+            if (bv[i / 64] & mask) {
+                return false;
+            }
+            bv[i / 64] |= mask;
+            this->update(i, 1);
+            return true;
+        }
+
+        bool clear_bit(uint64_t *bv, uint64_t i) {
+            uint64_t mask = 1ul << (i % 64);
+            if (!(bv[i / 64] & mask)) {
+                return false;
+            }
+            bv[i / 64] &= ~mask;
+            this->update(i, -1);
+            return true;
+        }
+
+        // applies pending updates to l0 and places the select samples exactly
+        // again, queries do what they need of this themselves so it only
+        // needs calling to control when it happens
+        void flush() {
+            this->flush_select(true);
+        }
+
+        uint64_t *get_l0() {
+            this->flush_l0();
+            return this->l0;
+        }
+
+        uint64_t get_one_count() {
+            this->flush_l0();
+            return this->one_count;
+        }
+
+        void save(const std::string &path, const uint64_t *bv) {
+            this->flush();
+            Base::save(path, bv);
+        }
+
+        uint64_t rank1(const uint64_t *bv, uint64_t i) {
+            this->flush_l0();
+            return Base::rank1(bv, i);
+        }
+
+        uint64_t rank0(const uint64_t *bv, uint64_t i) {
+            this->flush_l0();
+            return Base::rank0(bv, i);
+        }
+
+        uint64_t select1(const uint64_t *bv, uint64_t i) {
+            this->flush_select(false);
+            return Base::select1(bv, i);
+        }
+
+        uint64_t select0(const uint64_t *bv, uint64_t i) {
+            this->flush_select(false);
+            return Base::select0(bv, i);
+        }
+
+        void rank1_batch(const uint64_t *bv, const uint64_t *positions, uint64_t *out, size_t n) {
+            this->flush_l0();
+            Base::rank1_batch(bv, positions, out, n);
+        }
+
+        void select1_batch(const uint64_t *bv, const uint64_t *ranks, uint64_t *out, size_t n) {
+            this->flush_select(false);
+            Base::select1_batch(bv, ranks, out, n);
+        }
+
+        size_t select_range(const uint64_t *bv, uint64_t r_begin, uint64_t r_end, uint64_t *out) {
+            this->flush_select(false);
+            return Base::select_range(bv, r_begin, r_end, out);
+        }
+
+        // valid until the next update
+        OneRange ones(const uint64_t *bv, uint64_t i = 1) {
+            this->flush_select(false);
+            return Base::ones(bv, i);
+        }
+
+        void rank1_sorted(const uint64_t *bv, const uint64_t *positions, uint64_t *out, size_t n) {
+            this->flush_l0();
+            Base::rank1_sorted(bv, positions, out, n);
+        }
+
+};
+
+#endif /* DYNAMIC_ORZO_H */
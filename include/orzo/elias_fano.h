@@ -0,0 +1,282 @@
+#ifndef ELIAS_FANO_H
+#define ELIAS_FANO_H
+
+#include <cstdint>
+#include <algorithm>
+#include <bit>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <immintrin.h>
+#include "utils.h"
+#include "popcount.h"
+#include "select_word.h"
+#include "allocator.h"
+
+/*
+ * Rank and select over the positions of the ones of a sparse bit vector,
+ * stored as one elias-fano sequence rather than as the bits themselves. With
+ * m ones in n bits each position is split into LOWER_WIDTH = floor(log2(n /
+ * m)) low bits, packed back to back in lower, and its high bits, stored in
+ * unary in upper: the k-th position sets bit k + (position >> LOWER_WIDTH).
+ * That is 2 + log2(n / m) bits per one, against n / m for the bit vector, so
+ * below a density of around 1/5 this is the smaller of the two.
+ *
+ * select1(i) is a select on upper, which like the l2s of Orzo is answered by
+ * a pdep/tzcnt select in the right word, found from a sample every
+ * EF_SELECT_SAMPLE ones. rank1(i) finds where the bucket of i's high bits
+ * starts and ends with select0s on upper, sampled every EF_SELECT_SAMPLE
+ * zeros, and binary searches the lows below i's in that bucket.
+ *
+ * The queries take the bit vector like Orzo's so the two are interchangeable
+ * (ex. in AutoOrzo), but never read it, so it can be freed after
+ * construction.
+ */
+template<typename Allocator = MallocAllocator>
+class EliasFanoOrzo {
+
+    private:
+
+        static constexpr uint64_t EF_SELECT_SAMPLE = 512;
+
+        uint64_t bv_count = 0;
+        uint64_t one_count = 0;
+        uint64_t LOWER_WIDTH = 0;
+        uint64_t lower_mask = 0;
+        uint64_t *lower = nullptr;
+        uint64_t *upper = nullptr;
+        // positions in upper of every EF_SELECT_SAMPLE-th one and zero
+        uint64_t *select1_samples = nullptr;
+        uint64_t *select0_samples = nullptr;
+        uint64_t lower_words = 0;
+        uint64_t upper_count = 0; // bits of upper
+        uint64_t upper_words = 0;
+        uint64_t select1_sample_count = 0;
+        uint64_t select0_sample_count = 0;
+
+        Allocator allocator;
+
+        template<typename T>
+        T *allocate_array(size_t count) {
+            return (T*) this->allocator.allocate(count * sizeof(T));
+        }
+
+        template<typename T>
+        void deallocate_array(T *array, size_t count) {
+            if (array) {
+                this->allocator.deallocate(array, count * sizeof(T));
+            }
+        }
+
+        // the low bits of the k-th one, lower has a word of padding unless
+        // LOWER_WIDTH is zero, which leaves it with the padding word alone
+        uint64_t get_lower(uint64_t k) const {
+            if (this->LOWER_WIDTH == 0) {
+                return 0;
+            }
+            uint64_t bit = k * this->LOWER_WIDTH;
+            __uint128_t words = this->lower[bit / 64] | ((__uint128_t) this->lower[(bit / 64) + 1] << 64);
+            return (uint64_t) (words >> (bit % 64)) & this->lower_mask;
+        }
+
+        // position in upper of its k-th (0-based) one, or zero if !ones
+        template<bool ones>
+        uint64_t select_upper(uint64_t k) const {
+            const uint64_t *samples = (ones) ? this->select1_samples : this->select0_samples;
+            uint64_t position = samples[k / EF_SELECT_SAMPLE];
+            uint64_t rank = k % EF_SELECT_SAMPLE;
+            uint64_t word_idx = position / 64;
+            uint64_t word = (ones) ? this->upper[word_idx] : ~this->upper[word_idx];
+            // the sampled bit is the 0th of those left to skip
+            word &= UINT64_MAX << (position % 64);
+            uint64_t popc;
+            while ((popc = (uint64_t) std::popcount(word)) <= rank) {
+                rank -= popc;
+                ++word_idx;
+                word = (ones) ? this->upper[word_idx] : ~this->upper[word_idx];
+            }
+            return (word_idx * 64) + select_in_word(word, rank);
+        }
+
+        // positions of the first sample_count EF_SELECT_SAMPLE-th ones (zeros)
+        // of upper, whose padding would otherwise read as more zeros
+        template<bool ones>
+        void build_samples(uint64_t *samples, uint64_t sample_count) {
+            uint64_t seen = 0;
+            size_t num_samples = 0;
+            for (uint64_t w = 0; w < this->upper_words && num_samples < sample_count; ++w) {
+                uint64_t word = (ones) ? this->upper[w] : ~this->upper[w];
+                uint64_t popc = (uint64_t) std::popcount(word);
+                // the next sample is the (num_samples * EF_SELECT_SAMPLE)-th bit
+                while (num_samples < sample_count && (num_samples * EF_SELECT_SAMPLE) < (seen + popc)) {
+                    uint64_t rank = (num_samples * EF_SELECT_SAMPLE) - seen;
+                    samples[num_samples++] = (w * 64) + select_in_word(word, rank);
+                }
+                seen += popc;
+            }
+        }
+
+    public:
+
+        // floor(log2(bv_count / one_count)), the low bits kept per one. no
+        // ones are treated as one so upper stays a few bits
+        static uint64_t lower_width(uint64_t bv_count, uint64_t one_count) {
+            if (bv_count <= one_count) {
+                return 0;
+            }
+            return (uint64_t) (std::bit_width(bv_count / std::max<uint64_t>(one_count, 1)) - 1);
+        }
+
+        // bytes of the sequence of one_count ones in bv_count bits and its
+        // samples, as space_usage() would give once built
+        static uint64_t space_estimate(uint64_t bv_count, uint64_t one_count) {
+            uint64_t width = lower_width(bv_count, one_count);
+            uint64_t upper_count = one_count + (bv_count >> width) + 1;
+            uint64_t zero_count = upper_count - one_count;
+            uint64_t words = (((one_count * width) + 63) / 64 + 1) + ((upper_count + 63) / 64 + 1)
+                + ((one_count + EF_SELECT_SAMPLE - 1) / EF_SELECT_SAMPLE)
+                + ((zero_count + EF_SELECT_SAMPLE - 1) / EF_SELECT_SAMPLE);
+            return words * sizeof(uint64_t);
+        }
+
+        /*
+         * Chunks of the bit vector are popcounted in parallel, and once the
+         * number of ones before each chunk is known, each chunk writes its own
+         * elements. Neighbouring chunks can share a word of lower or upper at
+         * their boundary, so bits are set with atomic ors.
+         */
+        EliasFanoOrzo(
+            const uint64_t *bv,
+            size_t bv_count,
+            size_t num_threads = std::thread::hardware_concurrency(),
+            Allocator allocator = Allocator()
+        ) : bv_count(bv_count), allocator(allocator) {
+            constexpr uint64_t CHUNK_WORDS = 1ul << 14;
+            uint64_t num_words = (bv_count + 63) / 64;
+            uint64_t num_chunks = (num_words + CHUNK_WORDS - 1) / CHUNK_WORDS;
+            std::vector<uint64_t> chunk_ranks(num_chunks + 1, 0);
+            // bits past bv_count in the last word are not part of the vector
+            auto word_at = [&](uint64_t w) {
+                uint64_t word = bv[w];
+                if (((w + 1) * 64) > bv_count) {
+                    word &= (1ul << (bv_count % 64)) - 1;
+                }
+                return word;
+            };
+            parallel_for(num_chunks, num_threads, [&](size_t chunk) {
+                uint64_t start = chunk * CHUNK_WORDS * 64;
+                uint64_t bits = std::min<uint64_t>(bv_count - start, CHUNK_WORDS * 64);
+                chunk_ranks[chunk + 1] = popcount_prefix(&(bv[chunk * CHUNK_WORDS]), bits);
+            });
+            for (uint64_t chunk = 0; chunk < num_chunks; ++chunk) {
+                chunk_ranks[chunk + 1] += chunk_ranks[chunk];
+            }
+            this->one_count = chunk_ranks[num_chunks];
+            this->LOWER_WIDTH = lower_width(bv_count, this->one_count);
+            this->lower_mask = (1ul << this->LOWER_WIDTH) - 1;
+            this->lower_words = ((this->one_count * this->LOWER_WIDTH) + 63) / 64 + 1;
+            this->upper_count = this->one_count + (bv_count >> this->LOWER_WIDTH) + 1;
+            // a word of padding for the scans in select_upper
+            this->upper_words = (this->upper_count + 63) / 64 + 1;
+            this->lower = this->allocate_array<uint64_t>(this->lower_words);
+            this->upper = this->allocate_array<uint64_t>(this->upper_words);
+            parallel_for(num_chunks, num_threads, [&](size_t chunk) {
+                uint64_t end = std::min<uint64_t>(num_words, (chunk + 1) * CHUNK_WORDS);
+                uint64_t k = chunk_ranks[chunk];
+                for (uint64_t w = chunk * CHUNK_WORDS; w < end; ++w) {
+                    for (uint64_t word = word_at(w); word; word &= word - 1, ++k) {
+                        uint64_t position = (w * 64) + std::countr_zero(word);
+                        uint64_t high = k + (position >> this->LOWER_WIDTH);
+                        __atomic_fetch_or(&(this->upper[high / 64]), 1ul << (high % 64), __ATOMIC_RELAXED);
+                        if (this->LOWER_WIDTH) {
+                            uint64_t low = position & this->lower_mask;
+                            uint64_t bit = k * this->LOWER_WIDTH;
+                            __atomic_fetch_or(&(this->lower[bit / 64]), low << (bit % 64), __ATOMIC_RELAXED);
+                            if (((bit % 64) + this->LOWER_WIDTH) > 64) {
+                                __atomic_fetch_or(&(this->lower[(bit / 64) + 1]), low >> (64 - (bit % 64)), __ATOMIC_RELAXED);
+                            }
+                        }
+                    }
+                }
+            });
+            uint64_t zero_count = this->upper_count - this->one_count;
+            this->select1_sample_count = (this->one_count + EF_SELECT_SAMPLE - 1) / EF_SELECT_SAMPLE;
+            this->select0_sample_count = (zero_count + EF_SELECT_SAMPLE - 1) / EF_SELECT_SAMPLE;
+            this->select1_samples = this->allocate_array<uint64_t>(this->select1_sample_count);
+            this->select0_samples = this->allocate_array<uint64_t>(this->select0_sample_count);
+            this->build_samples<true>(this->select1_samples, this->select1_sample_count);
+            this->build_samples<false>(this->select0_samples, this->select0_sample_count);
+        }
+
+        EliasFanoOrzo(const EliasFanoOrzo&) = delete;
+        EliasFanoOrzo &operator=(const EliasFanoOrzo&) = delete;
+
+        EliasFanoOrzo(EliasFanoOrzo &&other) noexcept
+            : bv_count(other.bv_count),
+              one_count(other.one_count),
+              LOWER_WIDTH(other.LOWER_WIDTH),
+              lower_mask(other.lower_mask),
+              lower(std::exchange(other.lower, nullptr)),
+              upper(std::exchange(other.upper, nullptr)),
+              select1_samples(std::exchange(other.select1_samples, nullptr)),
+              select0_samples(std::exchange(other.select0_samples, nullptr)),
+              lower_words(other.lower_words),
+              upper_count(other.upper_count),
+              upper_words(other.upper_words),
+              select1_sample_count(other.select1_sample_count),
+              select0_sample_count(other.select0_sample_count),
+              allocator(other.allocator) {}
+
+        ~EliasFanoOrzo() {
+            this->deallocate_array(this->lower, this->lower_words);
+            this->deallocate_array(this->upper, this->upper_words);
+            this->deallocate_array(this->select1_samples, this->select1_sample_count);
+            this->deallocate_array(this->select0_samples, this->select0_sample_count);
+        }
+
+        uint64_t get_one_count() const { return this->one_count; }
+
+        // bytes of the sequence and its samples
+        uint64_t space_usage() const {
+            return (this->lower_words + this->upper_words
+                + this->select1_sample_count + this->select0_sample_count) * sizeof(uint64_t);
+        }
+
+        // number of ones before position i, bv is not read
+        uint64_t rank1(const uint64_t *bv, uint64_t i) const {
+            if (this->one_count == 0) {
+                return 0;
+            }
+            uint64_t high = i >> this->LOWER_WIDTH;
+            uint64_t low = i & this->lower_mask;
+            // bucket high starts after the high-th zero, all ones before it
+            // are of positions with smaller high bits
+            uint64_t position = (high) ? (this->select_upper<false>(high - 1) + 1) : 0;
+            uint64_t k = position - high;
+            // the bucket ends at the next zero, and its lows are sorted, so
+            // the ones below i's are found by a branchless binary search
+            // rather than a scan, which clustered ones could make 2 ** LOWER_WIDTH long
+            uint64_t len = (this->select_upper<false>(high) - high) - k;
+            while (len > 0) {
+                uint64_t half = len / 2;
+                bool below = this->get_lower(k + half) < low;
+                k = (below) ? (k + half + 1) : k;
+                len = (below) ? (len - half - 1) : half;
+            }
+            return k;
+        }
+
+        uint64_t rank0(const uint64_t *bv, uint64_t i) const {
+            return i - this->rank1(bv, i);
+        }
+
+        // position of the i-th one, 1-based, bv is not read
+        uint64_t select1(const uint64_t *bv, uint64_t i) const {
+            uint64_t k = i - 1;
+            uint64_t high = this->select_upper<true>(k) - k;
+            return (high << this->LOWER_WIDTH) | this->get_lower(k);
+        }
+
+};
+
+#endif /* ELIAS_FANO_H */
@@ -0,0 +1,151 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * On-disk layout of a saved Orzo index. The file starts with an
+ * OrzoFileHeader, followed by one section per array, each starting at a
+ * multiple of ORZO_SECTION_ALIGNMENT bytes. A section is found by offset, not
+ * by position, so readers never need to parse what comes before it. The
+ * arrays are stored exactly as they are laid out in memory, so mapping the
+ * file gives arrays that queries use in place. Several processes mapping the
+ * same file share its pages in the page cache. Everything is stored in the
+ * byte order of the machine that wrote it, and map() rejects files whose
+ * version or block geometry differ from what it expects.
+ */
+
+static constexpr char ORZO_MAGIC[8] = {'O', 'R', 'Z', 'O', 'I', 'D', 'X', '\0'};
+static constexpr uint64_t ORZO_FORMAT_VERSION = 3;
+// page aligned, which also keeps basic blocks cache line aligned
+static constexpr uint64_t ORZO_SECTION_ALIGNMENT = 4096;
+
+enum OrzoSectionId : uint64_t {
+    ORZO_SECTION_BV = 0,
+    ORZO_SECTION_L0,
+    ORZO_SECTION_L1L2,
+    ORZO_SECTION_SELECT_SAMPLES,
+    ORZO_SECTION_SELECT0_SAMPLES,
+    ORZO_SECTION_COUNT
+};
+
+struct OrzoSection {
+    uint64_t offset; // from the start of the file, in bytes
+    uint64_t size; // in bytes, 0 if the section is absent
+};
+
+struct OrzoFileHeader {
+    char magic[8];
+    uint64_t version;
+    // template parameters of the Orzo that wrote the file
+    uint64_t basic_block_count;
+    uint64_t l1l2_count;
+    uint64_t n_l2;
+    uint64_t use_l0;
+    uint64_t support_select;
+    uint64_t support_select0;
+    uint64_t bv_count;
+    uint64_t one_count;
+    uint64_t l1l2_index_count;
+    uint64_t select_sample_count;
+    uint64_t select0_sample_count;
+    OrzoSection sections[ORZO_SECTION_COUNT];
+};
+
+// writes header followed by the given sections, filling in the section table
+inline void orzo_write_file(
+    const std::string &path,
+    OrzoFileHeader header,
+    const void *const data[ORZO_SECTION_COUNT],
+    const uint64_t sizes[ORZO_SECTION_COUNT]
+) {
+    memcpy(header.magic, ORZO_MAGIC, sizeof(ORZO_MAGIC));
+    header.version = ORZO_FORMAT_VERSION;
+    uint64_t offset = sizeof(OrzoFileHeader);
+    for (uint64_t i = 0; i < ORZO_SECTION_COUNT; ++i) {
+        offset = ((offset + ORZO_SECTION_ALIGNMENT - 1) / ORZO_SECTION_ALIGNMENT) * ORZO_SECTION_ALIGNMENT;
+        header.sections[i] = {offset, sizes[i]};
+        offset += sizes[i];
+    }
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("orzo: cannot open " + path + " for writing");
+    }
+    out.write((const char*) &header, sizeof(header));
+    static const char padding[ORZO_SECTION_ALIGNMENT] = {0};
+    uint64_t written = sizeof(header);
+    for (uint64_t i = 0; i < ORZO_SECTION_COUNT; ++i) {
+        out.write(padding, header.sections[i].offset - written);
+        out.write((const char*) data[i], sizes[i]);
+        written = header.sections[i].offset + sizes[i];
+    }
+    if (!out) {
+        throw std::runtime_error("orzo: failed writing " + path);
+    }
+}
+
+// maps path read only and checks its header, size is set to the mapped length
+inline void *orzo_map_file(const std::string &path, size_t &size) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("orzo: cannot open " + path + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("orzo: cannot stat " + path + ": " + strerror(errno));
+    }
+    size = (size_t) st.st_size;
+    if (size < sizeof(OrzoFileHeader)) {
+        close(fd);
+        throw std::runtime_error("orzo: " + path + " is too small to be an index");
+    }
+    void *base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        throw std::runtime_error("orzo: cannot map " + path + ": " + strerror(errno));
+    }
+    const OrzoFileHeader *header = (const OrzoFileHeader*) base;
+    bool valid = (memcmp(header->magic, ORZO_MAGIC, sizeof(ORZO_MAGIC)) == 0)
+        && (header->version == ORZO_FORMAT_VERSION);
+    for (uint64_t i = 0; valid && (i < ORZO_SECTION_COUNT); ++i) {
+        const OrzoSection &section = header->sections[i];
+        valid = ((section.offset % ORZO_SECTION_ALIGNMENT) == 0)
+            && (section.offset <= size) && (section.size <= (size - section.offset));
+    }
+    if (!valid) {
+        munmap(base, size);
+        throw std::runtime_error("orzo: " + path + " is not a version "
+            + std::to_string(ORZO_FORMAT_VERSION) + " index");
+    }
+    return base;
+}
+
+/*
+ * Whether the sections of header have the sizes the counts in it call for.
+ * The bit vector section may be absent, or longer than the whole basic
+ * blocks queries read, every other section must be exactly as expected.
+ */
+inline bool orzo_sections_match(const OrzoFileHeader &header, const uint64_t sizes[ORZO_SECTION_COUNT]) {
+    uint64_t bv_size = header.sections[ORZO_SECTION_BV].size;
+    if ((bv_size != 0) && (bv_size < sizes[ORZO_SECTION_BV])) {
+        return false;
+    }
+    for (uint64_t i = ORZO_SECTION_L0; i < ORZO_SECTION_COUNT; ++i) {
+        if (header.sections[i].size != sizes[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif /* FORMAT_H */
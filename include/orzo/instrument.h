@@ -0,0 +1,38 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <cstdint>
+
+/*
+ * Compile-time hook counting the loop iterations of the select hot paths.
+ * Built with ORZO_INSTRUMENT (make INSTRUMENT=1) every step adds to the
+ * calling thread's orzo_scan_counts, which a benchmark reads before and after
+ * a query loop. Otherwise ORZO_COUNT expands to nothing and queries are
+ * unchanged. Counts are per thread so const queries stay safe to share.
+ */
+struct OrzoScanCounts {
+    uint64_t selects = 0;        // select1 and select0 calls, batched or not
+    uint64_t lower_searches = 0; // binary search steps over l0 and l1
+    uint64_t lower_scans = 0;    // lower block scan steps, an AVX2 step covers four blocks
+    uint64_t l2_scans = 0;       // L2s compared in the l2 scan, one per AVX2 compare
+    uint64_t word_scans = 0;     // words skipped in the basic block before the answer
+
+    OrzoScanCounts operator-(const OrzoScanCounts &o) const {
+        return {
+            this->selects - o.selects,
+            this->lower_searches - o.lower_searches,
+            this->lower_scans - o.lower_scans,
+            this->l2_scans - o.l2_scans,
+            this->word_scans - o.word_scans
+        };
+    }
+};
+
+#ifdef ORZO_INSTRUMENT
+inline thread_local OrzoScanCounts orzo_scan_counts;
+#define ORZO_COUNT(counter, n) (orzo_scan_counts.counter += (n))
+#else
+#define ORZO_COUNT(counter, n) ((void) 0)
+#endif
+
+#endif /* INSTRUMENT_H */
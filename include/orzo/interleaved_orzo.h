@@ -0,0 +1,163 @@
+#ifndef INTERLEAVED_ORZO_H
+#define INTERLEAVED_ORZO_H
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <immintrin.h>
+#include "orzo.h"
+
+/*
+ * An Orzo whose rank reads one slot of the bit vector and nothing else. The
+ * bits are copied into slots of LOWER_PER_SLOT lower blocks, each slot led by
+ * a header cache line holding, for each of its lower blocks, the number of
+ * ones before it (l0 and l1 summed into 64 bits) and its l1l2 entry, whose
+ * l2s the rank decodes as Orzo's does:
+ *
+ * [ rank 0 | rank 1 | l1l2 0 | l1l2 1 | unused ][ basic blocks of lower block 0 ][ ... of lower block 1 ]
+ *
+ * Both lines a rank touches, the header and the basic block, are found from
+ * the position alone, so their misses overlap rather than chain, and they lie
+ * within the same 1472 byte slot and so, but for slots straddling a page
+ * boundary, the same page and TLB entry. With huge pages (HugePageAllocator)
+ * every slot shares its TLB entry with its header. The header line costs
+ * 1/22 of the bits against 1/44 for the split l0 and l1l2 arrays.
+ *
+ * select still starts from the split index, built first and kept alongside,
+ * and finishes in the slot. The queries take bv like Orzo's but never read
+ * it, so it can be freed once the constructor returns.
+ */
+template<
+    uint64_t BASIC_BLOCK_COUNT = 512,
+    uint64_t L1L2_COUNT = 128,
+    uint64_t N_L2 = 10,
+    bool use_l0 = true,
+    bool support_select = true,
+    bool support_select0 = false,
+    typename Allocator = MallocAllocator
+>
+class InterleavedOrzo : protected Orzo<BASIC_BLOCK_COUNT, L1L2_COUNT, N_L2, use_l0, support_select, support_select0, Allocator> {
+
+    private:
+
+        using Base = Orzo<BASIC_BLOCK_COUNT, L1L2_COUNT, N_L2, use_l0, support_select, support_select0, Allocator>;
+
+        static constexpr uint64_t LOWER_PER_SLOT = 2;
+        static constexpr uint64_t HEADER_WORDS = 8; // one cache line
+        static constexpr uint64_t SLOT_WORDS = HEADER_WORDS + (LOWER_PER_SLOT * Base::LOWER_BLOCK_WORDS);
+
+        static_assert((LOWER_PER_SLOT * (sizeof(uint64_t) + sizeof(__uint128_t))) <= (HEADER_WORDS * sizeof(uint64_t)),
+            "the ranks and l1l2 entries of a slot must fit its header line");
+
+        uint64_t *slots = nullptr;
+        uint64_t slot_count = 0;
+
+        const uint64_t *slot_of(uint64_t l1l2_idx) const {
+            return this->slots + ((l1l2_idx / LOWER_PER_SLOT) * SLOT_WORDS);
+        }
+
+        // the words of basic block bb, where the split layout has them at
+        // bb * BASIC_BLOCK_WORDS
+        const uint64_t *basic_block_words(uint64_t bb) const {
+            uint64_t l1l2_idx = bb / (N_L2 + 1);
+            uint64_t k = l1l2_idx % LOWER_PER_SLOT;
+            return this->slot_of(l1l2_idx) + HEADER_WORDS + (k * Base::LOWER_BLOCK_WORDS)
+                + ((bb % (N_L2 + 1)) * Base::BASIC_BLOCK_WORDS);
+        }
+
+    public:
+
+        /*
+         * Builds the split Orzo index from bv, then copies the bits of every
+         * slot and fills its header from that index, slots in parallel. Like
+         * Orzo, bv is read in whole basic blocks.
+         */
+        InterleavedOrzo(
+            const uint64_t *bv,
+            size_t bv_count,
+            size_t num_threads = std::thread::hardware_concurrency(),
+            Allocator allocator = Allocator()
+        ) : Base(bv, bv_count, num_threads, allocator) {
+            size_t num_lower_blocks = this->L1L2_INDEX_COUNT;
+            size_t num_basic_blocks = (bv_count + BASIC_BLOCK_COUNT - 1) / BASIC_BLOCK_COUNT;
+            this->slot_count = (num_lower_blocks + LOWER_PER_SLOT - 1) / LOWER_PER_SLOT;
+            this->slots = this->template allocate_array<uint64_t>(this->slot_count * SLOT_WORDS);
+            parallel_for(this->slot_count, num_threads, [&](size_t slot_idx) {
+                uint64_t *slot = this->slots + (slot_idx * SLOT_WORDS);
+                __uint128_t *entries = (__uint128_t*) (slot + LOWER_PER_SLOT);
+                for (uint64_t k = 0; k < LOWER_PER_SLOT; ++k) {
+                    size_t l1l2_idx = (slot_idx * LOWER_PER_SLOT) + k;
+                    if (l1l2_idx >= num_lower_blocks) {
+                        break;
+                    }
+                    slot[k] = this->lower_block_rank(l1l2_idx);
+                    entries[k] = this->l1l2[l1l2_idx];
+                    size_t first_bb = l1l2_idx * (N_L2 + 1);
+                    size_t bb_count = std::min<size_t>(N_L2 + 1, num_basic_blocks - first_bb);
+                    memcpy(slot + HEADER_WORDS + (k * Base::LOWER_BLOCK_WORDS),
+                        &(bv[first_bb * Base::BASIC_BLOCK_WORDS]),
+                        bb_count * Base::BASIC_BLOCK_WORDS * sizeof(uint64_t));
+                }
+            });
+        }
+
+        InterleavedOrzo(InterleavedOrzo &&other) noexcept
+            : Base(std::move(other)),
+              slots(std::exchange(other.slots, nullptr)),
+              slot_count(other.slot_count) {}
+
+        ~InterleavedOrzo() {
+            this->deallocate_array(this->slots, this->slot_count * SLOT_WORDS);
+        }
+
+        using Base::get_one_count;
+
+        // bytes of the slots, bits included, and of the split index kept for select
+        uint64_t space_usage() const {
+            return Base::space_usage() + (this->slot_count * SLOT_WORDS * sizeof(uint64_t));
+        }
+
+        bool access(uint64_t i) const {
+            const uint64_t *words = this->basic_block_words(i / BASIC_BLOCK_COUNT);
+            uint64_t j = i % BASIC_BLOCK_COUNT;
+            return (words[j / 64] >> (j % 64)) & 1;
+        }
+
+        uint64_t rank1(const uint64_t *bv, uint64_t i) const {
+            uint64_t l1l2_idx = i / Base::LOWER_BLOCK_COUNT;
+            uint64_t k = l1l2_idx % LOWER_PER_SLOT;
+            const uint64_t *slot = this->slot_of(l1l2_idx);
+            // distance into lower block in bits, [0, LOWER_BLOCK_COUNT)
+            uint64_t j = i - (l1l2_idx * Base::LOWER_BLOCK_COUNT);
+            const uint64_t *words = slot + HEADER_WORDS + (k * Base::LOWER_BLOCK_WORDS)
+                + ((j / BASIC_BLOCK_COUNT) * Base::BASIC_BLOCK_WORDS);
+            __uint128_t entry = ((const __uint128_t*) (slot + LOWER_PER_SLOT))[k];
+            return slot[k] + Base::l2_rank(entry, j / BASIC_BLOCK_COUNT) + popcount_prefix(words, j % BASIC_BLOCK_COUNT);
+        }
+
+        uint64_t rank0(const uint64_t *bv, uint64_t i) const {
+            return i - this->rank1(bv, i);
+        }
+
+        uint64_t select1(const uint64_t *bv, uint64_t i) const {
+            uint64_t limit;
+            uint64_t l1l2_idx = this->select_sample(i, limit);
+            uint64_t rank;
+            uint64_t bb = this->select1_basic_block(i, l1l2_idx, limit, rank) / Base::BASIC_BLOCK_WORDS;
+            return (bb * BASIC_BLOCK_COUNT) + Base::select1_in_block(this->basic_block_words(bb), 0, rank);
+        }
+
+        uint64_t select0(const uint64_t *bv, uint64_t i) const {
+            static_assert(support_select0, "select0 needs support_select0");
+            uint64_t limit;
+            uint64_t l1l2_idx = this->template select_sample<true>(i, limit);
+            uint64_t rank;
+            uint64_t bb = this->select0_basic_block(i, l1l2_idx, limit, rank) / Base::BASIC_BLOCK_WORDS;
+            return (bb * BASIC_BLOCK_COUNT) + Base::select0_in_block(this->basic_block_words(bb), 0, rank);
+        }
+
+};
+
+#endif /* INTERLEAVED_ORZO_H */
@@ -9,77 +9,231 @@
 #include <cassert>
 #include <bit>
 #include <bitset>
+#include <concepts>
 #include <vector>
+#include <iterator>
 #include <iostream>
+#include <thread>
+#include <utility>
+#include <string>
 #include <immintrin.h>
 #include "utils.h"
+#include "popcount.h"
+#include "select_word.h"
+#include "set_op.h"
+#include "format.h"
+#include "allocator.h"
+#include "instrument.h"
 
 using std::cout, std::endl;
 
+/*
+ * Forward iterator over the positions of the set bits of a bit vector, from
+ * a starting position to the end of its word_count words, where it equals
+ * end(). Each step clears the lowest set bit of the current word and takes
+ * the next word once it is empty, so a full pass is one sequential read of
+ * the words. Orzo::ones starts one at the i-th one with a single select.
+ */
+class OneIterator {
+
+    private:
+
+        const uint64_t *bv = nullptr;
+        uint64_t word_idx = 0;
+        uint64_t word = 0;
+        uint64_t word_count = 0;
+
+        void skip_empty() {
+            while ((this->word == 0) && (++this->word_idx < this->word_count)) {
+                this->word = this->bv[this->word_idx];
+            }
+        }
+
+    public:
+
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = uint64_t;
+        using difference_type = int64_t;
+        using pointer = const uint64_t*;
+        using reference = uint64_t;
+
+        OneIterator() = default;
+
+        // at the first set bit at or after position
+        OneIterator(const uint64_t *bv, uint64_t word_count, uint64_t position)
+            : bv(bv), word_idx(std::min(position / 64, word_count)), word_count(word_count) {
+            if (this->word_idx < word_count) {
+                this->word = bv[this->word_idx] & (~0ULL << (position % 64));
+                this->skip_empty();
+            }
+        }
+
+        static OneIterator end(const uint64_t *bv, uint64_t word_count) {
+            return OneIterator(bv, word_count, word_count * 64);
+        }
+
+        uint64_t operator*() const {
+            return (this->word_idx * 64) + std::countr_zero(this->word);
+        }
+
+        OneIterator &operator++() {
+            this->word &= this->word - 1;
+            this->skip_empty();
+            return *this;
+        }
+
+        OneIterator operator++(int) {
+            OneIterator before = *this;
+            ++(*this);
+            return before;
+        }
+
+        bool operator==(const OneIterator &o) const {
+            return (this->word_idx == o.word_idx) && (this->word == o.word);
+        }
+
+};
+
+// the iterators of Orzo::ones, for range for loops
+struct OneRange {
+    OneIterator first;
+    OneIterator last;
+    OneIterator begin() const { return this->first; }
+    OneIterator end() const { return this->last; }
+};
+
+template<uint64_t, uint64_t, uint64_t, typename>
+class OrzoCollection;
+
+template<typename>
+class WaveletMatrix;
+
 template<
     uint64_t BASIC_BLOCK_COUNT = 512,
     uint64_t L1L2_COUNT = 128,
     uint64_t N_L2 = 10,
     bool use_l0 = true,
-    bool support_select = true
+    bool support_select = true,
+    bool support_select0 = false,
+    typename Allocator = MallocAllocator
 >
 class Orzo {
 
-    private:
+    // packs the same blocks and entries into its arena
+    template<uint64_t, uint64_t, uint64_t, typename>
+    friend class OrzoCollection;
+    // sizes the index arrays of its levels to carve them from its arena
+    template<typename>
+    friend class WaveletMatrix;
+
+    protected:
 
         uint64_t bv_count;
         uint64_t one_count;
-        uint64_t *l0;
+        uint64_t *l0 = nullptr;
         /*
-         * orzo reduces the width of the L1 indices to 18 bits, and so this
-         * is the size of an upper block. This turns out not to be a major
-         * performance problem for rank queries, but select queries need to
-         * scan or binary search the l0 index, which is more challenging
-         * with more entries. Hence, we use a different upper block size for
-         * rank and for select, and use ~2**32 bit upper blocks for select).
+         * select_samples[k] is the index of the lower block holding the
+         * (k * SELECT_SAMPLE + 1)-th one, over the whole bit vector. A select
+         * reads its sample straight from its rank, so reaching the lower
+         * blocks to scan takes one load however large the bit vector is,
+         * rather than a search over upper blocks first. select0_samples are
+         * the same for zeros.
          */
-        uint64_t *select_l0;
-        uint32_t **select_samples;
-        //uint32_t **select_sample_ptrs;
-        __uint128_t *l1l2; // interleaved l1 and l2 indices
+        uint32_t *select_samples = nullptr;
+        uint32_t *select0_samples = nullptr;
+        __uint128_t *l1l2 = nullptr; // interleaved l1 and l2 indices
+        // set when the arrays above point into a file mapped by map(), which
+        // also holds the bit vector
+        void *mapping = nullptr;
+        size_t mapping_size = 0;
+        uint64_t *mapped_bv = nullptr;
 
+        /*
+         * Block geometry, all derived from the template parameters. An l1l2
+         * entry holds N_L2 elias-fano coded L2 counts (the count at the end
+         * of each basic block of a lower block but the last) and, above them,
+         * the l1 count. Whatever bits the L2s leave bound the l1 count and so
+         * the size of an upper block, which is the largest whole number of
+         * lower blocks whose counts (before the last lower block) fit.
+         */
         // counts are of bits, sizes are in bytes
         static constexpr uint64_t BASIC_BLOCK_WORDS = BASIC_BLOCK_COUNT / 64;
-        static constexpr uint64_t LOWER_BLOCK_COUNT = (N_L2 + 1) * 512; // 5632
+        static constexpr uint64_t LOWER_BLOCK_COUNT = (N_L2 + 1) * BASIC_BLOCK_COUNT;
         static constexpr uint64_t LOWER_BLOCK_WORDS = LOWER_BLOCK_COUNT / 64;
-        static constexpr uint64_t L2_UNIVERSE = N_L2 * 512;
+        static constexpr uint64_t L2_UNIVERSE = N_L2 * BASIC_BLOCK_COUNT;
         static constexpr uint64_t EF_UPPER_BV_COUNT = 2 * N_L2;
-        static constexpr uint64_t EF_UPPER_ELE_COUNT = 2;
-        const uint64_t EF_LOWER_BV_COUNT = N_L2 * (uint64_t) std::ceil(std::log2((float) L2_UNIVERSE / (float) N_L2));
-        const uint64_t EF_LOWER_ELE_COUNT = EF_LOWER_BV_COUNT / N_L2;
-        const uint64_t EF_TOTAL_COUNT = EF_UPPER_BV_COUNT + EF_LOWER_BV_COUNT;
-        // pow(2, L1L2_COUNT - EF_TOTAL_COUNT)
-        // temporarily hardcoded for L1L2_COUNT = 10, needs to be evenly divisible by lower block count
-        const uint64_t UPPER_BLOCK_COUNT = 259072; //2ul << ((L1L2_COUNT - EF_TOTAL_COUNT) - 1);
-        const uint64_t LOWER_PER_UPPER = UPPER_BLOCK_COUNT / LOWER_BLOCK_COUNT;
+        // ceil(log2(L2_UNIVERSE / N_L2))
+        static constexpr uint64_t EF_LOWER_ELE_COUNT = std::bit_width((L2_UNIVERSE / N_L2) - 1);
+        static constexpr uint64_t EF_LOWER_BV_COUNT = N_L2 * EF_LOWER_ELE_COUNT;
+        static constexpr uint64_t EF_TOTAL_COUNT = EF_UPPER_BV_COUNT + EF_LOWER_BV_COUNT;
+        // bits of an l1 count, at most 32 so select upper blocks hold an upper block
+        static constexpr uint64_t L1_COUNT = std::min<uint64_t>(L1L2_COUNT - EF_TOTAL_COUNT, 32);
+        static constexpr uint64_t LOWER_PER_UPPER = (1ul << L1_COUNT) / LOWER_BLOCK_COUNT;
+        static constexpr uint64_t UPPER_BLOCK_COUNT = LOWER_PER_UPPER * LOWER_BLOCK_COUNT; // 259072
         static constexpr uint64_t BASIC_BLOCK_SIZE = (BASIC_BLOCK_COUNT / 8);
         static constexpr uint64_t LOWER_BLOCK_SIZE = (LOWER_BLOCK_COUNT / 8);
-        const uint64_t UPPER_BLOCK_SIZE = (UPPER_BLOCK_COUNT / 8);
-        // ceil(log2(N_L2)) can't be constexpr in C++20, 23 so this should work the same for integer N_L2
-        static constexpr uint64_t EF_UPPER_SPLIT_COUNT = (63 - std::countl_zero(N_L2)) + ((uint64_t) !std::has_single_bit(N_L2));
-        // number of buckets necessary is the upper bits of max
-        // number represented, +1 to account for the zero bucket,
-        // can't just shift by EF_LOWER_ELE_COUNT bc not constexpr
-        static constexpr uint64_t NUM_BUCKETS = (L2_UNIVERSE >> (64 - (std::countl_zero(L2_UNIVERSE) + EF_UPPER_SPLIT_COUNT))) + 1;
-        const uint64_t EF_LOWER_MASK = (2 << (EF_LOWER_ELE_COUNT - 1)) - 1;
-        const uint64_t EF_UPPER_BV_MASK = (2 << (EF_UPPER_BV_COUNT - 1)) - 1; 
-        static constexpr uint64_t SELECT_SAMPLE = 8192; //11264; //8192;
-        // (2 ** 32) - 4096 so that it is evenly divisible by 5632 AND by UPPER_BLOCK_COUNT, simplifies select logic
-        static constexpr uint64_t SELECT_UPPER_BLOCK_COUNT = 4294895616; //4294963200; //4294967296; // 2 ** 32
-        static constexpr uint64_t L1L2_PER_SELECT_UPPER = SELECT_UPPER_BLOCK_COUNT / LOWER_BLOCK_COUNT;
-
-        uint64_t SELECT_L0_ENTRY_COUNT;
+        static constexpr uint64_t UPPER_BLOCK_SIZE = (UPPER_BLOCK_COUNT / 8);
+        // the upper part of an L2 is at most this, +1 to account for the zero bucket
+        static constexpr uint64_t NUM_BUCKETS = (L2_UNIVERSE >> EF_LOWER_ELE_COUNT) + 1;
+        static constexpr uint64_t EF_LOWER_MASK = (1ul << EF_LOWER_ELE_COUNT) - 1;
+        static constexpr uint64_t EF_UPPER_BV_MASK = (1ul << EF_UPPER_BV_COUNT) - 1;
+        static constexpr uint64_t SELECT_SAMPLE = 8192;
+        // samples hold 32 bit lower block indices, so with select the bit
+        // vector is at most 2 ** 32 lower blocks, ~2 ** 44.5 bits by default
+        static constexpr uint64_t MAX_SELECT_BV_COUNT = (1ul << 32) * LOWER_BLOCK_COUNT;
+        // select scans the lower blocks between two consecutive samples when
+        // there are at most this many, and binary searches them otherwise
+        static constexpr uint64_t SELECT_SCAN_LIMIT = 32;
+
+        static_assert(L1L2_COUNT == 128, "l1l2 entries are stored as __uint128_t");
+        static_assert((BASIC_BLOCK_COUNT >= 64) && ((BASIC_BLOCK_COUNT % 64) == 0),
+            "basic blocks must be whole words");
+        static_assert((N_L2 >= 1) && (EF_UPPER_BV_COUNT < 64),
+            "the unary L2 upper parts must fit in one word");
+        static_assert(EF_TOTAL_COUNT < L1L2_COUNT, "no bits left for the l1 count");
+        static_assert(LOWER_PER_UPPER >= 1,
+            "the l1 count cannot cover a lower block, use fewer or smaller basic blocks");
+        static_assert((NUM_BUCKETS + N_L2 - 1) <= EF_UPPER_BV_COUNT,
+            "the unary L2 upper parts overflow their bits");
+
+        // how many queries ahead of the one being answered the batched queries
+        // prefetch for, enough to keep ~10 misses in flight per stage
+        static constexpr uint64_t BATCH_PREFETCH_DISTANCE = 16;
+        // how far ahead rank1_sorted popcounts its way rather than asking the
+        // index again, past this the scan loses to rank1 on branch misses
+        static constexpr uint64_t SORTED_RANK_SCAN_WORDS = 4;
+        // positions rank1_sorted judges dense or sparse together
+        static constexpr uint64_t SORTED_RANK_CHUNK = 256;
+
+        uint64_t SELECT_SAMPLE_COUNT = 0;
+        uint64_t SELECT0_SAMPLE_COUNT = 0;
         uint64_t L1L2_INDEX_COUNT;
+        // how many samples either way of the right one a select may start or
+        // stop from, 0 unless DynamicOrzo has updates the samples lag behind
+        uint64_t select_slack = 0;
+
+        Allocator allocator;
+
+        // only used by map() and combine()
+        Orzo() = default;
+
+        // zeroed arrays from the allocator policy
+        template<typename T>
+        T *allocate_array(size_t count) {
+            return (T*) this->allocator.allocate(count * sizeof(T));
+        }
+
+        template<typename T>
+        void deallocate_array(T *array, size_t count) {
+            if (array) {
+                this->allocator.deallocate(array, count * sizeof(T));
+            }
+        }
 
     public:
 
         // [ l1 | ef_upper: end ... start | ef_lower: nth ... 0th ]
-        __uint128_t elias_fano_encode(uint64_t *elements) {
+        static __uint128_t elias_fano_encode(uint64_t *elements) {
             __uint128_t result = 0;
             uint64_t buckets[NUM_BUCKETS] = {0};
             for (uint64_t i = 0; i < N_L2; ++i) {
@@ -91,7 +245,7 @@ class Orzo {
             for (uint64_t i = 0; i < NUM_BUCKETS; ++i) {
                 uint64_t bucket_count = buckets[i];
                 for (uint64_t j = 0; j < bucket_count; ++j) {
-                    result |= (1 << counter);
+                    result |= ((__uint128_t) 1 << counter);
                     counter++;
                 }
                 counter++;
@@ -106,139 +260,369 @@ class Orzo {
             return result;
         }
 
-        uint64_t *get_l0() { return this->l0; }
-        __uint128_t *get_l1l2() { return this->l1l2; }
-        uint64_t get_one_count() { return this->one_count; }
+        uint64_t *get_l0() const { return this->l0; }
+        __uint128_t *get_l1l2() const { return this->l1l2; }
+        uint64_t get_one_count() const { return this->one_count; }
 
+        // bytes of the index arrays, not counting the bit vector
+        uint64_t space_usage() const {
+            uint64_t l0_count = (this->bv_count + UPPER_BLOCK_COUNT - 1) / UPPER_BLOCK_COUNT;
+            uint64_t bytes = ((l0_count + 1) * sizeof(uint64_t)) + (this->L1L2_INDEX_COUNT * sizeof(__uint128_t));
+            return bytes + ((this->SELECT_SAMPLE_COUNT + this->SELECT0_SAMPLE_COUNT) * sizeof(uint32_t));
+        }
 
-        Orzo(uint64_t *bv, size_t bv_count) : bv_count(bv_count) {
-            size_t l0_count = (size_t) std::ceil((float) bv_count / (float) UPPER_BLOCK_COUNT);
-            size_t num_lower_blocks = (size_t) std::ceil((float) bv_count / (float) LOWER_BLOCK_COUNT);
-            size_t num_basic_blocks = (size_t) std::ceil((float) bv_count / (float) BASIC_BLOCK_COUNT);
-            size_t bb_per_lower = LOWER_BLOCK_COUNT / BASIC_BLOCK_COUNT;
-            size_t bb_per_upper = UPPER_BLOCK_COUNT / BASIC_BLOCK_COUNT;
-            this->l0 = new uint64_t[l0_count + 1]();
-            this->l1l2 = new __uint128_t[num_lower_blocks]();
-            this->L1L2_INDEX_COUNT = num_lower_blocks;
-            size_t select_l0_count = (size_t) std::ceil((float) bv_count / (float) SELECT_UPPER_BLOCK_COUNT);
-            this->SELECT_L0_ENTRY_COUNT = select_l0_count;
-            size_t bb_per_select_upper = SELECT_UPPER_BLOCK_COUNT / BASIC_BLOCK_COUNT;
+        // bytes of a bit vector of bv_count bits holding one_count ones and
+        // its index, without building it
+        static uint64_t space_estimate(uint64_t bv_count, uint64_t one_count) {
+            uint64_t num_lower_blocks = (bv_count + LOWER_BLOCK_COUNT - 1) / LOWER_BLOCK_COUNT;
+            uint64_t l0_count = (bv_count + UPPER_BLOCK_COUNT - 1) / UPPER_BLOCK_COUNT;
+            uint64_t bytes = (((bv_count + 63) / 64) * sizeof(uint64_t)) + (num_lower_blocks * sizeof(__uint128_t))
+                + ((l0_count + 1) * sizeof(uint64_t));
             if constexpr(support_select) {
-                this->select_l0 = new uint64_t[select_l0_count + 1]();
-            }
-            size_t l0_idx = 1;
-            size_t select_l0_idx = 1;
-            size_t l1l2_idx = 0;
-            size_t hot_count_total = 0;
-            size_t count_within_upper = 0;
-            //size_t count_within_select_upper = 0;
-            size_t count_within_lower = 0;
-            // first entry (index 0) is never used, exists to simplify logic, the first
-            // l2 entry is at index 1, second at index 2, etc.
+                bytes += select_sample_count(one_count) * sizeof(uint32_t);
+            }
+            if constexpr(support_select0) {
+                bytes += select_sample_count(bv_count - one_count) * sizeof(uint32_t);
+            }
+            return bytes;
+        }
+
+
+        // counts the basic blocks of lower block l1l2_idx with count_block(bb),
+        // the ones in basic block bb, and writes its l1l2 entry given the ones
+        // before it in its upper block, returns the number of ones in the
+        // lower block
+        template<std::invocable<size_t> CountBlock>
+        uint64_t build_lower(CountBlock &&count_block, size_t l1l2_idx, size_t num_basic_blocks, uint64_t count_within_upper) {
+            size_t bb_per_lower = LOWER_BLOCK_COUNT / BASIC_BLOCK_COUNT;
+            size_t lower_start = l1l2_idx * bb_per_lower;
+            // l2_counts[k] is the count up to the end of the kth basic block in
+            // the lower block, the last one is never stored. basic blocks past
+            // the end of a partial lower block count as empty
             uint64_t l2_counts[N_L2 + 1] = {0};
-            // increment over all basic blocks
-            for (size_t i = 1; i <= num_basic_blocks; ++i) {
-                size_t bb_offset = (i - 1) * (BASIC_BLOCK_SIZE / 8);
-                uint64_t *bb_start = &(bv[bb_offset]);
-                size_t num_words = BASIC_BLOCK_SIZE / sizeof(*bv);
-                uint64_t basic_count = 0;
-                for (size_t j = 0; j < num_words; ++j) {
-                    basic_count += (uint64_t) std::popcount(bb_start[j]);
-                }
-                hot_count_total += basic_count;
-                count_within_lower += basic_count;
-                l2_counts[i % (N_L2 + 1)] = count_within_lower;
-                bool end_of_lower = not ((bool) (i % bb_per_lower));
-                if (end_of_lower) {
-                    this->l1l2[l1l2_idx] |= ((__uint128_t) count_within_upper << EF_TOTAL_COUNT);
-                    __uint128_t elias_fano_l2s = this->elias_fano_encode(l2_counts + 1);
-                    this->l1l2[l1l2_idx] |= elias_fano_l2s;
-                    count_within_upper += count_within_lower;
-                    //count_within_select_upper += count_within_lower;
-                    count_within_lower = 0;
-                    ++l1l2_idx;
+            uint64_t count_within_lower = 0;
+            for (size_t k = 0; k < bb_per_lower; ++k) {
+                size_t bb = lower_start + k;
+                if (bb < num_basic_blocks) {
+                    count_within_lower += count_block(bb);
                 }
-                bool end_of_upper = not ((bool) (i % bb_per_upper));
-                if (end_of_upper) {
-                    this->l0[l0_idx] = hot_count_total;
-                    count_within_upper = 0;
-                    ++l0_idx;
+                l2_counts[k] = count_within_lower;
+            }
+            this->l1l2[l1l2_idx] = ((__uint128_t) count_within_upper << EF_TOTAL_COUNT)
+                | this->elias_fano_encode(l2_counts);
+            return count_within_lower;
+        }
+
+        // build_lower popcounting the basic blocks of bv
+        uint64_t build_lower(const uint64_t *bv, size_t l1l2_idx, size_t num_basic_blocks, uint64_t count_within_upper) {
+            return this->build_lower([bv](size_t bb) {
+                return popcount_words(&(bv[bb * BASIC_BLOCK_WORDS]), BASIC_BLOCK_WORDS);
+            }, l1l2_idx, num_basic_blocks, count_within_upper);
+        }
+
+        // writes the l1l2 entries of the lower blocks of upper block upper_idx,
+        // returns the number of ones in the upper block. upper blocks share no
+        // index state so these can run in parallel
+        template<std::invocable<size_t> CountBlock>
+        uint64_t build_upper(CountBlock &&count_block, size_t upper_idx, size_t num_basic_blocks) {
+            size_t num_lower_blocks = (num_basic_blocks * BASIC_BLOCK_COUNT + LOWER_BLOCK_COUNT - 1) / LOWER_BLOCK_COUNT;
+            size_t first = upper_idx * LOWER_PER_UPPER;
+            size_t last = std::min<size_t>(first + LOWER_PER_UPPER, num_lower_blocks);
+            uint64_t count_within_upper = 0;
+            for (size_t l1l2_idx = first; l1l2_idx < last; ++l1l2_idx) {
+                count_within_upper += this->build_lower(count_block, l1l2_idx, num_basic_blocks, count_within_upper);
+            }
+            return count_within_upper;
+        }
+
+        // number of ones before lower block l1l2_idx, from l0 and l1 alone
+        uint64_t lower_block_rank(uint64_t l1l2_idx) const {
+            return this->l0[l1l2_idx / LOWER_PER_UPPER] + (uint64_t) (this->l1l2[l1l2_idx] >> EF_TOTAL_COUNT);
+        }
+
+        // number of zeros before lower block l1l2_idx
+        uint64_t lower_block_rank0(uint64_t l1l2_idx) const {
+            return (l1l2_idx * LOWER_BLOCK_COUNT) - this->lower_block_rank(l1l2_idx);
+        }
+
+        // samples kept for count ones (zeros), at least one so the array
+        // always exists
+        static uint64_t select_sample_count(uint64_t count) {
+            return std::max<uint64_t>(1, (count + SELECT_SAMPLE - 1) / SELECT_SAMPLE);
+        }
+
+        // writes the samples of the ones (or zeros) in upper block upper_idx
+        // into select_samples (or select0_samples). the counts written while
+        // popcounting are enough to place every sample, so the bit vector is
+        // not read again, and upper blocks own disjoint samples so these can
+        // run in parallel once l0 is summed
+        template<bool zeros = false>
+        void build_select_samples(size_t upper_idx) {
+            uint32_t *samples = (zeros) ? this->select0_samples : this->select_samples;
+            uint64_t first = upper_idx * LOWER_PER_UPPER;
+            uint64_t last = std::min<uint64_t>(this->L1L2_INDEX_COUNT, first + LOWER_PER_UPPER);
+            uint64_t total = (zeros) ? (this->bv_count - this->one_count) : this->one_count;
+            uint64_t start_rank = (zeros) ? this->lower_block_rank0(first) : this->lower_block_rank(first);
+            // the first sample whose one (zero) comes after start_rank others
+            uint64_t k = (start_rank + SELECT_SAMPLE - 1) / SELECT_SAMPLE;
+            for (uint64_t l1l2_idx = first; l1l2_idx < last; ++l1l2_idx) {
+                // ones (zeros) up to the end of this lower block
+                uint64_t end_rank = total;
+                if ((l1l2_idx + 1) < this->L1L2_INDEX_COUNT) {
+                    end_rank = (zeros) ? this->lower_block_rank0(l1l2_idx + 1) : this->lower_block_rank(l1l2_idx + 1);
                 }
-                if constexpr(support_select) {
-                    bool end_of_select_upper = not ((bool) (i % bb_per_select_upper));
-                    if (end_of_select_upper) {
-                        this->select_l0[select_l0_idx] = hot_count_total;
-                        //count_within_select_upper = 0;
-                        ++select_l0_idx;
-                    }
+                while (((k * SELECT_SAMPLE) + 1) <= end_rank) {
+                    samples[k++] = (uint32_t) l1l2_idx;
                 }
             }
-            this->l0[l0_idx] = hot_count_total;
-            this->l1l2[l1l2_idx] |= ((__uint128_t) count_within_upper << EF_TOTAL_COUNT);
-            __uint128_t elias_fano_l2s = this->elias_fano_encode(l2_counts + 1);
-            this->l1l2[l1l2_idx] |= elias_fano_l2s;
-            this->one_count = hot_count_total;
-            // using a vector here for convenience but the data is copied to
-            // the select_samples allocation with a fixed size to ensure std::vector
-            // doesn't use more memory behind the scenes than is necessary
-            std::vector<std::vector<uint32_t>> select_samples_tmp;
-            for (size_t i = 0; i < select_l0_count; ++i) {
-                std::vector<uint32_t> tmp;
-                select_samples_tmp.push_back(tmp);
+        }
+
+        /*
+         * Construction is split into upper blocks, which are counted and
+         * encoded by num_threads workers independently of one another since l1
+         * counts restart at every upper block. Only l0 depends on what came
+         * before, and it is filled in by a prefix sum over the per upper block
+         * counts once all workers are done. With those counts known the select
+         * samples are placed straight into one exactly sized array, per upper
+         * block and also in parallel. select0 samples, if enabled, are placed
+         * the same way from the zero counts. count_block(bb) gives the ones in
+         * basic block bb and is called once for each, the bit vector is not
+         * read otherwise.
+         */
+        template<std::invocable<size_t> CountBlock>
+        void build(CountBlock &&count_block, size_t num_threads) {
+            size_t l0_count = (this->bv_count + UPPER_BLOCK_COUNT - 1) / UPPER_BLOCK_COUNT;
+            size_t num_lower_blocks = (this->bv_count + LOWER_BLOCK_COUNT - 1) / LOWER_BLOCK_COUNT;
+            size_t num_basic_blocks = (this->bv_count + BASIC_BLOCK_COUNT - 1) / BASIC_BLOCK_COUNT;
+            if ((support_select || support_select0) && (this->bv_count > MAX_SELECT_BV_COUNT)) {
+                throw std::length_error("orzo: select supports at most "
+                    + std::to_string(MAX_SELECT_BV_COUNT) + " bits");
             }
+            this->l0 = this->allocate_array<uint64_t>(l0_count + 1);
+            this->l1l2 = this->allocate_array<__uint128_t>(num_lower_blocks);
+            this->L1L2_INDEX_COUNT = num_lower_blocks;
+            // l0[u + 1] temporarily holds the count of upper block u alone
+            parallel_for(l0_count, num_threads, [&](size_t upper_idx) {
+                this->l0[upper_idx + 1] = this->build_upper(count_block, upper_idx, num_basic_blocks);
+            });
+            for (size_t i = 1; i <= l0_count; ++i) {
+                this->l0[i] += this->l0[i - 1];
+            }
+            this->one_count = this->l0[l0_count];
             if constexpr(support_select) {
-                this->select_l0[select_l0_idx] = hot_count_total;
-                this->select_samples = (uint32_t**) calloc(select_l0_count, sizeof(uint32_t*));
-                for (size_t i = 0; i < select_l0_count; ++i) {
-//                    select_samples_tmp[i].push_back(0);
-                    size_t cum = 0;
-                    size_t next = 1;
-                    size_t words_per_sel_upper = SELECT_UPPER_BLOCK_COUNT / 64;
-                    size_t words_in_bucket = words_per_sel_upper;
-                    if (i == (select_l0_count - 1)) {
-                        size_t partial = (bv_count / 64) % words_in_bucket;
-                        if (partial) {
-                            words_in_bucket = partial;
-                        }
-                    }
-                    for (size_t j = 0; j < words_in_bucket; ++j) {
-                        size_t full_word_idx = (i * words_per_sel_upper) + j;
-                        size_t popc = std::popcount(bv[full_word_idx]);
-                        cum += popc;
-                        if (cum >= next) {
-                            size_t local_l1l2_idx = j / LOWER_BLOCK_WORDS;
-                            select_samples_tmp[i].push_back(local_l1l2_idx);
-                            next += SELECT_SAMPLE;
-                        }
-                    }
-                }
-                for (size_t i = 0; i < select_samples_tmp.size(); ++i) {
-                    uint64_t bucket_size = select_samples_tmp[i].size();
-                    if (bucket_size == 0) { // at least one
-                        select_samples_tmp[i].push_back(0);
-                        bucket_size++;
-                    }
-                    this->select_samples[i] = (uint32_t*) calloc(bucket_size, sizeof(uint32_t));
-                    for (size_t j = 0; j < bucket_size; ++j) {
-                        this->select_samples[i][j] = select_samples_tmp[i][j];
-                    }
-                }
+                this->SELECT_SAMPLE_COUNT = select_sample_count(this->one_count);
+                this->select_samples = this->allocate_array<uint32_t>(this->SELECT_SAMPLE_COUNT);
+                parallel_for(l0_count, num_threads, [&](size_t upper_idx) {
+                    this->build_select_samples(upper_idx);
+                });
             }
+            if constexpr(support_select0) {
+                this->SELECT0_SAMPLE_COUNT = select_sample_count(this->bv_count - this->one_count);
+                this->select0_samples = this->allocate_array<uint32_t>(this->SELECT0_SAMPLE_COUNT);
+                parallel_for(l0_count, num_threads, [&](size_t upper_idx) {
+                    this->build_select_samples<true>(upper_idx);
+                });
+            }
+        }
+
+        Orzo(
+            const uint64_t *bv,
+            size_t bv_count,
+            size_t num_threads = std::thread::hardware_concurrency(),
+            Allocator allocator = Allocator()
+        ) : bv_count(bv_count), allocator(allocator) {
+            this->build([bv](size_t bb) {
+                return popcount_words(&(bv[bb * BASIC_BLOCK_WORDS]), BASIC_BLOCK_WORDS);
+            }, num_threads);
+        }
+
+        /*
+         * Writes op of bit vectors a and b, each of bv_count bits, to out and
+         * returns the index of out, in one pass: each basic block of the
+         * result is computed, stored and popcounted from registers by the same
+         * worker that encodes its lower block, so out is written once and
+         * never read back, where combining first and constructing after reads
+         * it again in full. Upper blocks are split over num_threads as in the
+         * constructor. a and b are read and out written in whole basic blocks,
+         * like bv is by the constructor, with the bits past bv_count zero in
+         * a and b (and so in out).
+         */
+        static Orzo combine(
+            SetOp op,
+            const uint64_t *a,
+            const uint64_t *b,
+            uint64_t *out,
+            size_t bv_count,
+            size_t num_threads = std::thread::hardware_concurrency(),
+            Allocator allocator = Allocator()
+        ) {
+            switch (op) {
+                case SetOp::AND:
+                    return combine<SetOp::AND>(a, b, out, bv_count, num_threads, allocator);
+                case SetOp::OR:
+                    return combine<SetOp::OR>(a, b, out, bv_count, num_threads, allocator);
+                case SetOp::XOR:
+                    return combine<SetOp::XOR>(a, b, out, bv_count, num_threads, allocator);
+                default:
+                    return combine<SetOp::ANDNOT>(a, b, out, bv_count, num_threads, allocator);
+            }
+        }
+
+        template<SetOp op>
+        static Orzo combine(
+            const uint64_t *a,
+            const uint64_t *b,
+            uint64_t *out,
+            size_t bv_count,
+            size_t num_threads = std::thread::hardware_concurrency(),
+            Allocator allocator = Allocator()
+        ) {
+            Orzo result;
+            result.bv_count = bv_count;
+            result.allocator = allocator;
+            result.build([a, b, out](size_t bb) {
+                size_t first = bb * BASIC_BLOCK_WORDS;
+                return combine_words<op>(a + first, b + first, out + first, BASIC_BLOCK_WORDS);
+            }, num_threads);
+            return result;
         }
 
+        // the index arrays are owned (or mapped), so instances move but never copy
+        Orzo(const Orzo&) = delete;
+        Orzo &operator=(const Orzo&) = delete;
+
+        Orzo(Orzo &&other) noexcept
+            : bv_count(other.bv_count),
+              one_count(other.one_count),
+              l0(std::exchange(other.l0, nullptr)),
+              select_samples(std::exchange(other.select_samples, nullptr)),
+              select0_samples(std::exchange(other.select0_samples, nullptr)),
+              l1l2(std::exchange(other.l1l2, nullptr)),
+              mapping(std::exchange(other.mapping, nullptr)),
+              mapping_size(other.mapping_size),
+              mapped_bv(std::exchange(other.mapped_bv, nullptr)),
+              SELECT_SAMPLE_COUNT(other.SELECT_SAMPLE_COUNT),
+              SELECT0_SAMPLE_COUNT(other.SELECT0_SAMPLE_COUNT),
+              L1L2_INDEX_COUNT(other.L1L2_INDEX_COUNT),
+              select_slack(other.select_slack),
+              allocator(other.allocator) {}
+
         ~Orzo() {
-            delete[] l0;
-            delete[] l1l2;
-            delete[] select_l0;
-            for (size_t i = 0; i < this->SELECT_L0_ENTRY_COUNT; ++i) {
-                free(this->select_samples[i]);
+            if (this->mapping) {
+                munmap(this->mapping, this->mapping_size);
+                return;
             }
-            free(this->select_samples);
+            uint64_t l0_count = (this->bv_count + UPPER_BLOCK_COUNT - 1) / UPPER_BLOCK_COUNT;
+            this->deallocate_array(this->l0, l0_count + 1);
+            this->deallocate_array(this->l1l2, this->L1L2_INDEX_COUNT);
+            this->deallocate_array(this->select_samples, this->SELECT_SAMPLE_COUNT);
+            this->deallocate_array(this->select0_samples, this->SELECT0_SAMPLE_COUNT);
         }
 
-        // assumes a bit layout like so:
-        // | 63 ... 1 0 | 127 ... 65 64 |
-        uint64_t rank1(uint64_t *bv, uint64_t i) {
+        /*
+         * Writes bv and the index to path in the format described in format.h,
+         * so that it can be loaded back with map() instead of being rebuilt.
+         * Whole basic blocks of bv are stored since the query kernels read them.
+         */
+        void save(const std::string &path, const uint64_t *bv) const {
+            OrzoFileHeader header = {};
+            header.basic_block_count = BASIC_BLOCK_COUNT;
+            header.l1l2_count = L1L2_COUNT;
+            header.n_l2 = N_L2;
+            header.use_l0 = use_l0;
+            header.support_select = support_select;
+            header.support_select0 = support_select0;
+            header.bv_count = this->bv_count;
+            header.one_count = this->one_count;
+            header.l1l2_index_count = this->L1L2_INDEX_COUNT;
+            header.select_sample_count = this->SELECT_SAMPLE_COUNT;
+            header.select0_sample_count = this->SELECT0_SAMPLE_COUNT;
+            const void *data[ORZO_SECTION_COUNT] = {
+                bv, this->l0, this->l1l2, this->select_samples, this->select0_samples
+            };
+            uint64_t sizes[ORZO_SECTION_COUNT];
+            section_sizes(this->bv_count, this->L1L2_INDEX_COUNT, this->SELECT_SAMPLE_COUNT,
+                this->SELECT0_SAMPLE_COUNT, sizes);
+            orzo_write_file(path, header, data, sizes);
+        }
+
+        // bytes of each section of an index over bv_count bits with the given
+        // entry and sample counts, as save() writes them
+        static void section_sizes(
+            uint64_t bv_count,
+            uint64_t l1l2_index_count,
+            uint64_t select_sample_count,
+            uint64_t select0_sample_count,
+            uint64_t sizes[ORZO_SECTION_COUNT]
+        ) {
+            uint64_t num_basic_blocks = (bv_count + BASIC_BLOCK_COUNT - 1) / BASIC_BLOCK_COUNT;
+            uint64_t l0_count = (bv_count + UPPER_BLOCK_COUNT - 1) / UPPER_BLOCK_COUNT;
+            sizes[ORZO_SECTION_BV] = num_basic_blocks * BASIC_BLOCK_SIZE;
+            sizes[ORZO_SECTION_L0] = (l0_count + 1) * sizeof(uint64_t);
+            sizes[ORZO_SECTION_L1L2] = l1l2_index_count * sizeof(__uint128_t);
+            sizes[ORZO_SECTION_SELECT_SAMPLES] = select_sample_count * sizeof(uint32_t);
+            sizes[ORZO_SECTION_SELECT0_SAMPLES] = select0_sample_count * sizeof(uint32_t);
+        }
+
+        /*
+         * Maps an index written by save(). Nothing is copied or rebuilt, the
+         * index arrays point into the read only mapping, and the bit vector to
+         * pass to queries is mapped_data(). The mapping lives as long as the
+         * returned Orzo.
+         */
+        static Orzo map(const std::string &path) {
+            Orzo orzo;
+            orzo.mapping = orzo_map_file(path, orzo.mapping_size);
+            const OrzoFileHeader *header = (const OrzoFileHeader*) orzo.mapping;
+            bool matches = (header->basic_block_count == BASIC_BLOCK_COUNT)
+                && (header->l1l2_count == L1L2_COUNT)
+                && (header->n_l2 == N_L2)
+                && (header->use_l0 == use_l0)
+                && (header->support_select == support_select)
+                && (header->support_select0 == support_select0);
+            if (!matches) {
+                // the destructor unmaps
+                throw std::runtime_error("orzo: " + path + " was written with a different geometry");
+            }
+            // the counts size every array queries read, so they must agree
+            // with each other and with the sections actually stored
+            uint64_t num_lower_blocks = (header->bv_count + LOWER_BLOCK_COUNT - 1) / LOWER_BLOCK_COUNT;
+            uint64_t zero_count = header->bv_count - header->one_count;
+            // (a bv_count that wraps the block count also fails the first test)
+            bool consistent = (header->bv_count <= (num_lower_blocks * LOWER_BLOCK_COUNT))
+                && (header->one_count <= header->bv_count)
+                && (header->l1l2_index_count == num_lower_blocks)
+                && (header->select_sample_count == ((support_select) ? select_sample_count(header->one_count) : 0))
+                && (header->select0_sample_count == ((support_select0) ? select_sample_count(zero_count) : 0));
+            uint64_t sizes[ORZO_SECTION_COUNT];
+            section_sizes(header->bv_count, header->l1l2_index_count, header->select_sample_count,
+                header->select0_sample_count, sizes);
+            if (!consistent || !orzo_sections_match(*header, sizes)) {
+                throw std::runtime_error("orzo: " + path + " is truncated or corrupt");
+            }
+            auto section = [&](OrzoSectionId id) {
+                const OrzoSection &s = header->sections[id];
+                return s.size ? (void*) ((char*) orzo.mapping + s.offset) : nullptr;
+            };
+            orzo.bv_count = header->bv_count;
+            orzo.one_count = header->one_count;
+            orzo.L1L2_INDEX_COUNT = header->l1l2_index_count;
+            orzo.SELECT_SAMPLE_COUNT = header->select_sample_count;
+            orzo.SELECT0_SAMPLE_COUNT = header->select0_sample_count;
+            orzo.mapped_bv = (uint64_t*) section(ORZO_SECTION_BV);
+            orzo.l0 = (uint64_t*) section(ORZO_SECTION_L0);
+            orzo.l1l2 = (__uint128_t*) section(ORZO_SECTION_L1L2);
+            orzo.select_samples = (uint32_t*) section(ORZO_SECTION_SELECT_SAMPLES);
+            orzo.select0_samples = (uint32_t*) section(ORZO_SECTION_SELECT0_SAMPLES);
+            return orzo;
+        }
+
+        // the bit vector of an index loaded with map(), nullptr otherwise
+        uint64_t *mapped_data() const { return this->mapped_bv; }
+
+        // number of ones before the basic block holding position i, from l0,
+        // l1 and l2 alone
+        uint64_t basic_block_rank(uint64_t i) const {
             uint64_t l1l2_idx = i / LOWER_BLOCK_COUNT;
             __uint128_t l1l2 = this->l1l2[l1l2_idx];
             uint64_t l1_count = (uint64_t) (l1l2 >> EF_TOTAL_COUNT);
@@ -249,108 +633,486 @@ class Orzo {
             }
             // distance into lower block in bits, [0, LOWER_BLOCK_COUNT)
             uint64_t j = i - (l1l2_idx * LOWER_BLOCK_COUNT);
-            // idx of basic block within lower block that i (and j) present in
-            uint64_t iob = (j / BASIC_BLOCK_COUNT);
-            if (iob) { // if 0 only do popcnts otherwise EF decode l2
-                uint64_t iob_dec = iob - 1;
-                uint64_t ef_lower = EF_LOWER_MASK & (l1l2 >> (EF_UPPER_BV_COUNT + (iob_dec * EF_LOWER_ELE_COUNT)));
-                // select1(iob)
-                uint64_t select_result = _tzcnt_u64(_pdep_u64(1ul << iob_dec, l1l2)) + 1;
-                uint64_t ef_upper = select_result - iob;
-                rank += ef_lower | (ef_upper << EF_LOWER_ELE_COUNT);
-            }
-            uint64_t bb_offset = (i / BASIC_BLOCK_COUNT) * 8;
-            uint64_t bits_considered = (i % BASIC_BLOCK_COUNT);
-            uint64_t num_popcounts = bits_considered / 64;
-            // full popcounts
-            uint64_t ii = 0;
-            for (; ii < num_popcounts; ++ii) {
-                uint64_t word = bv[bb_offset + ii];
-                rank += (uint64_t) std::popcount(word);
-            }
-            // partial popcount
-            bits_considered %= 64;
-            if (bits_considered) {
-                uint64_t word = bv[bb_offset + ii];
-                uint64_t shift = 64 - bits_considered;
-                word <<= shift;
-                rank += (uint64_t) std::popcount(word);
-            }
-            return rank;
-        }
-
-        uint64_t rank0(uint64_t *bv, uint64_t i) {
-            return 1 + (i - rank1(bv, i));
+            // plus the l2 of the basic block within the lower block holding i
+            return rank + l2_rank(l1l2, j / BASIC_BLOCK_COUNT);
+        }
+
+        // ones in the lower block of l1l2_entry before its basic block iob
+        static uint64_t l2_rank(__uint128_t l1l2_entry, uint64_t iob) {
+            if (iob == 0) { // there is no l2 before it, otherwise EF decode l2
+                return 0;
+            }
+            uint64_t iob_dec = iob - 1;
+            uint64_t ef_lower = EF_LOWER_MASK & (l1l2_entry >> (EF_UPPER_BV_COUNT + (iob_dec * EF_LOWER_ELE_COUNT)));
+            // select1(iob)
+            uint64_t select_result = select_in_word((uint64_t) l1l2_entry, iob_dec) + 1;
+            uint64_t ef_upper = select_result - iob;
+            return ef_lower | (ef_upper << EF_LOWER_ELE_COUNT);
+        }
+
+        // assumes a bit layout like so:
+        // | 63 ... 1 0 | 127 ... 65 64 |
+        uint64_t rank1(const uint64_t *bv, uint64_t i) const {
+            // full and partial popcounts within the basic block
+            uint64_t bb_offset = (i / BASIC_BLOCK_COUNT) * BASIC_BLOCK_WORDS;
+            return this->basic_block_rank(i) + popcount_prefix(&(bv[bb_offset]), i % BASIC_BLOCK_COUNT);
+        }
+
+        // zeros in [0, i), so rank0(select0(k)) == k - 1 as for rank1/select1
+        uint64_t rank0(const uint64_t *bv, uint64_t i) const {
+            return i - this->rank1(bv, i);
         }
         
-        uint64_t select1(uint64_t *bv, uint64_t i) {
-            uint64_t l0_idx = 0;
-            while (((l0_idx + 1) < this->SELECT_L0_ENTRY_COUNT) && (this->select_l0[l0_idx + 1] < i)) {
-                ++l0_idx;
-            }
-            // now this is just the rank we want *within* an upper select block
-            uint64_t l0 = this->select_l0[l0_idx];
-            uint64_t rank = i - l0;
-            uint32_t *sample_bucket = select_samples[l0_idx];
-            // this idx is *within* an upper select block
-            uint64_t l1l2_idx = sample_bucket[(rank - 1) / SELECT_SAMPLE];
-            // make it a full l1l2_idx
-            l1l2_idx += l0_idx * L1L2_PER_SELECT_UPPER;
-            // need to know *exact* rank of position at start of current lower block
-            // because our l1 indices store at max 2 ** 18, meaning one select upper
-            // block can contain multiple regular upper level blocks and the l1 value
-            // is not necessarily a true cumulative count of the rank within sel upper
-            // the +1 is to ensure rank is run on the starting bit of the current block
-            // (so the count will exclude its value)
-            uint64_t full_rank = this->l0[l1l2_idx / LOWER_PER_UPPER] + (this->l1l2[l1l2_idx] >> EF_TOTAL_COUNT);
-                //this->rank1(bv, (l1l2_idx * LOWER_BLOCK_COUNT) /*+ 1*/);
-            uint64_t full_next_rank = full_rank;
-            // limit (end of select upper block) is either: size of all l1l2 indices
-            // or: last L2 index in current select upper block, whichever is lower
-            uint64_t last_in_upper = (L1L2_PER_SELECT_UPPER * l0_idx) + L1L2_PER_SELECT_UPPER;
-            uint64_t limit = std::min<uint64_t>(L1L2_INDEX_COUNT, last_in_upper);
+        /*
+         * The lower block of the sample covering the i-th one (zero), from
+         * which select scans. The i-th one lies between it and the lower block
+         * of the next sample, if any, so limit is left just past the latter.
+         * Both samples are read from the rank alone, usually from one line.
+         * With select_slack the window is widened by that many samples on
+         * each side.
+         */
+        template<bool zeros = false>
+        uint64_t select_sample(uint64_t i, uint64_t &limit) const {
+            const uint32_t *samples = (zeros) ? this->select0_samples : this->select_samples;
+            uint64_t sample_count = (zeros) ? this->SELECT0_SAMPLE_COUNT : this->SELECT_SAMPLE_COUNT;
+            uint64_t k = (i - 1) / SELECT_SAMPLE;
+            uint64_t next = k + 1 + this->select_slack;
+            limit = (next < sample_count) ? (samples[next] + 1) : this->L1L2_INDEX_COUNT;
+            return (k >= this->select_slack) ? samples[k - this->select_slack] : 0;
+        }
+
+        /*
+         * Narrows [l1l2_idx, limit) down to at most SELECT_SCAN_LIMIT lower
+         * blocks still holding the last one starting before the i-th one
+         * (zero), by a branchless binary search over l0 and l1. Used when the
+         * samples are too far apart to scan (ex. in a sparse stretch after a
+         * dense one). The block at l1l2_idx must start before it, and the new
+         * limit is left in limit.
+         */
+        template<bool zeros = false>
+        uint64_t select_search_lower(uint64_t i, uint64_t l1l2_idx, uint64_t &limit) const {
+            uint64_t base = l1l2_idx;
+            uint64_t len = limit - l1l2_idx;
+            while (len > SELECT_SCAN_LIMIT) {
+                ORZO_COUNT(lower_searches, 1);
+                uint64_t half = len / 2;
+                uint64_t rank = (zeros) ? this->lower_block_rank0(base + half) : this->lower_block_rank(base + half);
+                base = (rank < i) ? (base + half) : base;
+                len -= half;
+            }
+            limit = base + len;
+            return base;
+        }
+
+        /*
+         * Moves l1l2_idx forward to the last lower block before limit that starts
+         * before the i-th one. The comparison needs the *exact* rank at the start
+         * of each lower block, l0 plus l1, since l1 counts restart at every
+         * upper block and samples can be upper blocks apart. With AVX2, four l1 counts from the same
+         * upper block are compared against the target at once. More than
+         * SELECT_SCAN_LIMIT lower blocks are binary searched instead, which
+         * bounds the work for any distribution of the ones.
+         */
+        uint64_t select1_scan_lower(uint64_t i, uint64_t l1l2_idx, uint64_t limit) const {
+            if ((limit - l1l2_idx) > SELECT_SCAN_LIMIT) {
+                l1l2_idx = this->select_search_lower(i, l1l2_idx, limit);
+            }
+            // the sample usually lands in or just before the target, so try
+            // the next lower block on its own first
+            if (((l1l2_idx + 1) >= limit) || (this->lower_block_rank(l1l2_idx + 1) >= i)) {
+                return l1l2_idx;
+            }
+            ++l1l2_idx;
             while ((l1l2_idx + 1) < limit) {
-                full_next_rank = this->l0[(l1l2_idx + 1) / LOWER_PER_UPPER]
-                        + (this->l1l2[l1l2_idx + 1] >> EF_TOTAL_COUNT);
-                if (full_next_rank >= i) {
+                ORZO_COUNT(lower_scans, 1);
+                uint64_t next = l1l2_idx + 1;
+#ifdef __AVX2__
+                if constexpr(EF_TOTAL_COUNT >= 64) {
+                    uint64_t upper = next / LOWER_PER_UPPER;
+                    if (((next + 4) <= limit) && (upper == ((next + 3) / LOWER_PER_UPPER))) {
+                        // l1 counts live in the high words, at l1l2 + 8, 24, 40, 56 bytes
+                        const __m256i *entries = (const __m256i*) &(this->l1l2[next]);
+                        __m256i high = _mm256_unpackhi_epi64(
+                            _mm256_loadu_si256(entries), _mm256_loadu_si256(entries + 1)
+                        );
+                        high = _mm256_permute4x64_epi64(high, _MM_SHUFFLE(3, 1, 2, 0));
+                        __m256i l1s = _mm256_srli_epi64(high, EF_TOTAL_COUNT - 64);
+                        // l0 + l1 >= i, signed since the upper block may start past i
+                        int64_t target = (int64_t) i - (int64_t) this->l0[upper];
+                        __m256i reached = _mm256_cmpgt_epi64(l1s, _mm256_set1_epi64x(target - 1));
+                        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(reached));
+                        if (mask) {
+                            return l1l2_idx + std::countr_zero((uint32_t) mask);
+                        }
+                        l1l2_idx += 4;
+                        continue;
+                    }
+                }
+#endif
+                if (this->lower_block_rank(next) >= i) {
                     break;
                 }
-                full_rank = full_next_rank;
-                ++l1l2_idx;
+                l1l2_idx = next;
             }
-            full_next_rank = full_rank;
-            rank -= (full_rank - l0);
-            // elias-fano scan and decode L2s
-            full_rank = 0;
-            uint64_t idx = 0;
-            __uint128_t l1l2_entry = this->l1l2[l1l2_idx];
-            __uint128_t l1l2_lower = l1l2_entry >> EF_UPPER_BV_COUNT;
-            for (; idx < N_L2; ++idx) {
-                uint64_t ef_upper_bits =
-                    ((_tzcnt_u64(_pdep_u64(1ul << idx, l1l2_entry)) /*+ 1*/) - idx)
-                    << EF_LOWER_ELE_COUNT;
-                uint64_t ef_lower_bits = EF_LOWER_MASK & (l1l2_lower >> (idx * EF_LOWER_ELE_COUNT));
-                uint64_t l2 = ef_lower_bits | ef_upper_bits;
-                uint64_t full_next_rank_2 = full_next_rank + l2;
-                if (full_next_rank_2 >= i) {
-                    break;
+            return l1l2_idx;
+        }
+
+        // decodes the idx-th elias-fano L2 of an l1l2 entry
+        static uint64_t decode_l2(__uint128_t l1l2_entry, uint64_t idx) {
+            uint64_t ef_upper = select_in_word((uint64_t) l1l2_entry, idx) - idx;
+            uint64_t ef_lower = EF_LOWER_MASK & (uint64_t) (l1l2_entry >> (EF_UPPER_BV_COUNT + (idx * EF_LOWER_ELE_COUNT)));
+            return ef_lower | (ef_upper << EF_LOWER_ELE_COUNT);
+        }
+
+        /*
+         * Finds the basic block within a lower block holding the rank-th one of
+         * the lower block. Returns its index and leaves the count before it in
+         * l2. Since the L2s are non-decreasing, the index is the number of L2s
+         * below rank, which is counted rather than found by decoding and testing
+         * the L2s one after another: the L2s whose upper part is below that of
+         * rank - 1 end where its bucket starts in the unary upper bits, and only
+         * the lower parts in that one bucket need comparing. With AVX2 all lower
+         * parts are unpacked into 16-bit lanes and compared in one step.
+         */
+        static uint64_t select1_scan_l2(__uint128_t l1l2_entry, uint64_t rank, uint64_t &l2) {
+            uint64_t target = rank - 1;
+            uint64_t target_upper = target >> EF_LOWER_ELE_COUNT;
+            uint64_t target_lower = target & EF_LOWER_MASK;
+            uint64_t ef_upper_bv = (uint64_t) l1l2_entry & EF_UPPER_BV_MASK;
+            // the zero closing bucket target_upper, any past the upper bits are implicit
+            uint64_t bucket_end = select_in_word(~ef_upper_bv, target_upper);
+            // L2s with upper part <= target_upper, and how many of them equal it
+            uint64_t count_le = bucket_end - target_upper;
+            uint64_t before_end = bucket_end ? (ef_upper_bv << (64 - bucket_end)) : 0;
+            uint64_t count_eq = (uint64_t) std::countl_one(before_end);
+            uint64_t count_lt = count_le - count_eq;
+            uint64_t idx = count_lt;
+#ifdef __AVX2__
+            if constexpr((N_L2 <= 16) && (EF_LOWER_ELE_COUNT <= 9)) {
+                // lane k gets the two bytes holding lower part k, then a multiply
+                // moves its top bit to bit 15 so a shift by 16 - width aligns it
+                alignas(32) int8_t shuffle[32];
+                alignas(32) int16_t multipliers[16];
+                for (uint64_t k = 0; k < 16; ++k) {
+                    uint64_t bit = EF_UPPER_BV_COUNT + (std::min<uint64_t>(k, N_L2 - 1) * EF_LOWER_ELE_COUNT);
+                    shuffle[2 * k] = (int8_t) (bit / 8);
+                    shuffle[(2 * k) + 1] = (int8_t) std::min<uint64_t>((bit / 8) + 1, 15);
+                    multipliers[k] = (int16_t) (1 << (16 - EF_LOWER_ELE_COUNT - (bit % 8)));
+                }
+                __m256i entry = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) &l1l2_entry));
+                __m256i lowers = _mm256_shuffle_epi8(entry, _mm256_load_si256((const __m256i*) shuffle));
+                lowers = _mm256_mullo_epi16(lowers, _mm256_load_si256((const __m256i*) multipliers));
+                lowers = _mm256_srli_epi16(lowers, 16 - EF_LOWER_ELE_COUNT);
+                __m256i lanes = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+                __m256i in_bucket = _mm256_and_si256(
+                    _mm256_cmpgt_epi16(lanes, _mm256_set1_epi16((int16_t) count_lt - 1)),
+                    _mm256_cmpgt_epi16(_mm256_set1_epi16((int16_t) count_le), lanes)
+                );
+                __m256i below = _mm256_and_si256(
+                    in_bucket,
+                    _mm256_cmpgt_epi16(_mm256_set1_epi16((int16_t) target_lower + 1), lowers)
+                );
+                idx += std::popcount((uint32_t) _mm256_movemask_epi8(below)) / 2;
+                ORZO_COUNT(l2_scans, 1);
+            } else
+#endif
+            {
+                __uint128_t l1l2_lower = l1l2_entry >> EF_UPPER_BV_COUNT;
+                ORZO_COUNT(l2_scans, count_le - count_lt);
+                for (uint64_t k = count_lt; k < count_le; ++k) {
+                    uint64_t ef_lower_bits = EF_LOWER_MASK & (uint64_t) (l1l2_lower >> (k * EF_LOWER_ELE_COUNT));
+                    idx += (uint64_t) (ef_lower_bits <= target_lower);
                 }
-                full_rank = l2;
             }
-            rank -= full_rank;
-            // select within basic block
-            // start_position is of first word in bb
-            uint64_t start_position = (l1l2_idx * LOWER_BLOCK_WORDS) + (idx * BASIC_BLOCK_WORDS);
+            l2 = idx ? decode_l2(l1l2_entry, idx - 1) : 0;
+            return idx;
+        }
+
+        // walks forward from the sampled lower block l1l2_idx to the basic block
+        // containing the i-th one, returns the position of the first word of that
+        // basic block and leaves the rank still to be found within it in rank.
+        // limit is from select_sample
+        uint64_t select1_basic_block(uint64_t i, uint64_t l1l2_idx, uint64_t limit, uint64_t &rank) const {
+            l1l2_idx = this->select1_scan_lower(i, l1l2_idx, limit);
+            rank = i - this->lower_block_rank(l1l2_idx);
+            uint64_t l2 = 0;
+            uint64_t idx = this->select1_scan_l2(this->l1l2[l1l2_idx], rank, l2);
+            rank -= l2;
+            return (l1l2_idx * LOWER_BLOCK_WORDS) + (idx * BASIC_BLOCK_WORDS);
+        }
+
+        // select within basic block, start_position is of first word in bb
+        static uint64_t select1_in_block(const uint64_t *bv, uint64_t start_position, uint64_t rank) {
             uint64_t popc = 0;
             while ((popc = std::popcount<uint64_t>(bv[start_position])) < rank) {
+                ORZO_COUNT(word_scans, 1);
                 ++start_position;
                 rank -= popc;
             }
-            uint64_t in_word_result = _tzcnt_u64(_pdep_u64(1ul << (rank - 1), bv[start_position]));
+            uint64_t in_word_result = select_in_word(bv[start_position], rank - 1);
             uint64_t final_result = (start_position * 64) + in_word_result;
             return final_result;
         }
+
+        uint64_t select1(const uint64_t *bv, uint64_t i) const {
+            ORZO_COUNT(selects, 1);
+            uint64_t limit;
+            uint64_t l1l2_idx = this->select_sample(i, limit);
+            uint64_t rank;
+            uint64_t start_position = this->select1_basic_block(i, l1l2_idx, limit, rank);
+            return this->select1_in_block(bv, start_position, rank);
+        }
+
+        /*
+         * select0 mirrors select1 step for step on its own samples. Zero counts
+         * are not stored, the number of zeros before any position is the
+         * position minus the ones before it, so each step compares those
+         * instead. Needs support_select0.
+         */
+        uint64_t select0_scan_lower(uint64_t i, uint64_t l1l2_idx, uint64_t limit) const {
+            if ((limit - l1l2_idx) > SELECT_SCAN_LIMIT) {
+                l1l2_idx = this->select_search_lower<true>(i, l1l2_idx, limit);
+            }
+            if (((l1l2_idx + 1) >= limit) || (this->lower_block_rank0(l1l2_idx + 1) >= i)) {
+                return l1l2_idx;
+            }
+            ++l1l2_idx;
+            while ((l1l2_idx + 1) < limit) {
+                ORZO_COUNT(lower_scans, 1);
+                uint64_t next = l1l2_idx + 1;
+#ifdef __AVX2__
+                if constexpr(EF_TOTAL_COUNT >= 64) {
+                    uint64_t upper = next / LOWER_PER_UPPER;
+                    if (((next + 4) <= limit) && (upper == ((next + 3) / LOWER_PER_UPPER))) {
+                        const __m256i *entries = (const __m256i*) &(this->l1l2[next]);
+                        __m256i high = _mm256_unpackhi_epi64(
+                            _mm256_loadu_si256(entries), _mm256_loadu_si256(entries + 1)
+                        );
+                        high = _mm256_permute4x64_epi64(high, _MM_SHUFFLE(3, 1, 2, 0));
+                        __m256i l1s = _mm256_srli_epi64(high, EF_TOTAL_COUNT - 64);
+                        // zeros before each lower block, less l0's zeros
+                        // which are the same for all four
+                        int64_t start = (int64_t) ((next * LOWER_BLOCK_COUNT) - this->l0[upper]);
+                        __m256i starts = _mm256_add_epi64(
+                            _mm256_set1_epi64x(start),
+                            _mm256_setr_epi64x(0, LOWER_BLOCK_COUNT, 2 * LOWER_BLOCK_COUNT, 3 * LOWER_BLOCK_COUNT)
+                        );
+                        __m256i zeros = _mm256_sub_epi64(starts, l1s);
+                        __m256i reached = _mm256_cmpgt_epi64(zeros, _mm256_set1_epi64x((int64_t) i - 1));
+                        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(reached));
+                        if (mask) {
+                            return l1l2_idx + std::countr_zero((uint32_t) mask);
+                        }
+                        l1l2_idx += 4;
+                        continue;
+                    }
+                }
+#endif
+                if (this->lower_block_rank0(next) >= i) {
+                    break;
+                }
+                l1l2_idx = next;
+            }
+            return l1l2_idx;
+        }
+
+        // like select1_scan_l2, but the zero counts (k + 1) * BASIC_BLOCK_COUNT
+        // - L2 k are not elias-fano coded, so every L2 is decoded and counted
+        uint64_t select0_scan_l2(__uint128_t l1l2_entry, uint64_t rank, uint64_t &l2) const {
+            uint64_t ef_upper_bv = (uint64_t) l1l2_entry & EF_UPPER_BV_MASK;
+            __uint128_t l1l2_lower = l1l2_entry >> EF_UPPER_BV_COUNT;
+            uint64_t idx = 0;
+            l2 = 0;
+            ORZO_COUNT(l2_scans, N_L2);
+            for (uint64_t k = 0; k < N_L2; ++k) {
+                // the kth one of the unary upper bits is at k + upper part k
+                uint64_t ef_upper = (uint64_t) std::countr_zero(ef_upper_bv) - k;
+                ef_upper_bv &= ef_upper_bv - 1;
+                uint64_t ef_lower = EF_LOWER_MASK & (uint64_t) (l1l2_lower >> (k * EF_LOWER_ELE_COUNT));
+                uint64_t zeros = ((k + 1) * BASIC_BLOCK_COUNT) - (ef_lower | (ef_upper << EF_LOWER_ELE_COUNT));
+                // zero counts are non-decreasing, so these hold for a prefix of k
+                bool below = zeros < rank;
+                idx += below;
+                l2 = (below) ? zeros : l2;
+            }
+            return idx;
+        }
+
+        uint64_t select0_basic_block(uint64_t i, uint64_t l1l2_idx, uint64_t limit, uint64_t &rank) const {
+            l1l2_idx = this->select0_scan_lower(i, l1l2_idx, limit);
+            rank = i - this->lower_block_rank0(l1l2_idx);
+            uint64_t l2 = 0;
+            uint64_t idx = this->select0_scan_l2(this->l1l2[l1l2_idx], rank, l2);
+            rank -= l2;
+            return (l1l2_idx * LOWER_BLOCK_WORDS) + (idx * BASIC_BLOCK_WORDS);
+        }
+
+        static uint64_t select0_in_block(const uint64_t *bv, uint64_t start_position, uint64_t rank) {
+            uint64_t popc = 0;
+            while ((popc = std::popcount<uint64_t>(~bv[start_position])) < rank) {
+                ORZO_COUNT(word_scans, 1);
+                ++start_position;
+                rank -= popc;
+            }
+            uint64_t in_word_result = select_in_word(~bv[start_position], rank - 1);
+            return (start_position * 64) + in_word_result;
+        }
+
+        // position of the i-th zero, 1-based like select1
+        uint64_t select0(const uint64_t *bv, uint64_t i) const {
+            static_assert(support_select0, "select0 needs support_select0");
+            ORZO_COUNT(selects, 1);
+            uint64_t limit;
+            uint64_t l1l2_idx = this->select_sample<true>(i, limit);
+            uint64_t rank;
+            uint64_t start_position = this->select0_basic_block(i, l1l2_idx, limit, rank);
+            return this->select0_in_block(bv, start_position, rank);
+        }
+
+        void prefetch_rank1(const uint64_t *bv, uint64_t i) const {
+            if constexpr(use_l0) {
+                _mm_prefetch((const char*) &(this->l0[i / UPPER_BLOCK_COUNT]), _MM_HINT_T0);
+            }
+            _mm_prefetch((const char*) &(this->l1l2[i / LOWER_BLOCK_COUNT]), _MM_HINT_T0);
+            _mm_prefetch((const char*) &(bv[(i / BASIC_BLOCK_COUNT) * BASIC_BLOCK_WORDS]), _MM_HINT_T0);
+        }
+
+        /*
+         * Batched queries. Each query is a short chain of dependent loads, so
+         * rather than resolving one query at a time and stalling on every miss,
+         * the loads for queries further along in the batch are issued as
+         * prefetches while earlier ones are answered. rank needs a single stage
+         * since every address it touches is known from the position. select
+         * needs three: the sample is read, then the l1l2 entries it points at,
+         * then the basic block the L2 decode lands in, each stage running
+         * BATCH_PREFETCH_DISTANCE queries behind the previous one.
+         */
+        void rank1_batch(const uint64_t *bv, const uint64_t *positions, uint64_t *out, size_t n) const {
+            size_t ahead = std::min<size_t>(n, BATCH_PREFETCH_DISTANCE);
+            for (size_t k = 0; k < ahead; ++k) {
+                this->prefetch_rank1(bv, positions[k]);
+            }
+            for (size_t k = 0; k < n; ++k) {
+                if ((k + BATCH_PREFETCH_DISTANCE) < n) {
+                    this->prefetch_rank1(bv, positions[k + BATCH_PREFETCH_DISTANCE]);
+                }
+                out[k] = this->rank1(bv, positions[k]);
+            }
+        }
+
+        void select1_batch(const uint64_t *bv, const uint64_t *ranks, uint64_t *out, size_t n) const {
+            constexpr int64_t D = BATCH_PREFETCH_DISTANCE;
+            ORZO_COUNT(selects, n);
+            // ring buffers carrying per query state between stages
+            uint64_t l1l2_idxs[D];
+            uint64_t limits[D];
+            uint64_t start_positions[D];
+            uint64_t remaining[D];
+            // each iteration runs every stage, the last stage first so that a
+            // slot is consumed before the stage behind it overwrites it. a
+            // negative k means the pipeline is still filling
+            for (int64_t k = -3 * D; k < (int64_t) n; ++k) {
+                if (k >= 0) {
+                    out[k] = this->select1_in_block(bv, start_positions[k % D], remaining[k % D]);
+                }
+                int64_t k3 = k + D;
+                if (k3 >= 0 && k3 < (int64_t) n) {
+                    uint64_t start_position = this->select1_basic_block(
+                        ranks[k3], l1l2_idxs[k3 % D], limits[k3 % D], remaining[k3 % D]
+                    );
+                    start_positions[k3 % D] = start_position;
+                    _mm_prefetch((const char*) &(bv[start_position]), _MM_HINT_T0);
+                }
+                int64_t k2 = k + 2 * D;
+                if (k2 >= 0 && k2 < (int64_t) n) {
+                    uint64_t l1l2_idx = this->select_sample(ranks[k2], limits[k2 % D]);
+                    l1l2_idxs[k2 % D] = l1l2_idx;
+                    _mm_prefetch((const char*) &(this->l1l2[l1l2_idx]), _MM_HINT_T0);
+                    _mm_prefetch((const char*) &(this->l1l2[l1l2_idx + 1]), _MM_HINT_T0);
+                    _mm_prefetch((const char*) &(this->l0[l1l2_idx / LOWER_PER_UPPER]), _MM_HINT_T0);
+                }
+                int64_t k1 = k + 3 * D;
+                if (k1 >= 0 && k1 < (int64_t) n) {
+                    _mm_prefetch((const char*) &(this->select_samples[(ranks[k1] - 1) / SELECT_SAMPLE]), _MM_HINT_T0);
+                }
+            }
+        }
         
+        /*
+         * Enumeration. A run of consecutive ones costs one select for its first
+         * and a tzcnt/blsr per one after that, the words read in order, rather
+         * than a select each. select_range writes the positions of the ones
+         * ranked [r_begin, r_end) (1-based, as select1) to out and returns how
+         * many it wrote, fewer if the vector runs out of ones. ones iterates
+         * from the i-th one to the last.
+         */
+        size_t select_range(const uint64_t *bv, uint64_t r_begin, uint64_t r_end, uint64_t *out) const {
+            r_end = std::min(r_end, this->one_count + 1);
+            if ((r_begin == 0) || (r_begin >= r_end)) {
+                return 0;
+            }
+            size_t count = r_end - r_begin;
+            uint64_t first = this->select1(bv, r_begin);
+            uint64_t word_idx = first / 64;
+            uint64_t word = bv[word_idx] & (~0ULL << (first % 64));
+            size_t k = 0;
+            while (true) {
+                while (word) {
+                    out[k++] = (word_idx * 64) + std::countr_zero(word);
+                    if (k == count) {
+                        return k;
+                    }
+                    word &= word - 1;
+                }
+                word = bv[++word_idx];
+            }
+        }
+
+        OneRange ones(const uint64_t *bv, uint64_t i = 1) const {
+            uint64_t word_count = (this->bv_count + 63) / 64;
+            OneIterator end = OneIterator::end(bv, word_count);
+            if ((i == 0) || (i > this->one_count)) {
+                return {end, end};
+            }
+            return {OneIterator(bv, word_count, this->select1(bv, i)), end};
+        }
+
+        /*
+         * rank1 of every position of a non-decreasing list, SORTED_RANK_CHUNK
+         * positions at a time. In a dense chunk the rank is carried from one
+         * position to the next: a position within SORTED_RANK_SCAN_WORDS
+         * words of the last popcounts the words in between, one further away
+         * starts over from the index, so the words stream by in order. A
+         * sparse chunk gains nothing from the carry and goes to rank1_batch,
+         * whose queries overlap. A list out of order is still answered right.
+         */
+        void rank1_sorted(const uint64_t *bv, const uint64_t *positions, uint64_t *out, size_t n) const {
+            for (size_t first = 0; first < n; first += SORTED_RANK_CHUNK) {
+                size_t count = std::min<size_t>(SORTED_RANK_CHUNK, n - first);
+                const uint64_t *chunk = positions + first;
+                if (((chunk[count - 1] - chunk[0]) / 64) > (count * SORTED_RANK_SCAN_WORDS)) {
+                    this->rank1_batch(bv, chunk, out + first, count);
+                    continue;
+                }
+                // the rank before word word_idx, from the start of the vector
+                // for each chunk so nothing carries over a batched one
+                uint64_t word_idx = 0;
+                uint64_t rank = 0;
+                for (size_t k = 0; k < count; ++k) {
+                    uint64_t i = chunk[k];
+                    uint64_t target = i / 64;
+                    if ((target - word_idx) > SORTED_RANK_SCAN_WORDS) {
+                        word_idx = target;
+                        rank = this->rank1(bv, target * 64);
+                    }
+                    for (; word_idx < target; ++word_idx) {
+                        rank += std::popcount(bv[word_idx]);
+                    }
+                    out[first + k] = rank + ((i % 64) ? std::popcount(bv[target] << (64 - (i % 64))) : 0);
+                }
+            }
+        }
+
         void print(size_t max_l0 = ULONG_MAX, size_t max_l1l2 = ULONG_MAX) {
             size_t l0_count = this->bv_count / UPPER_BLOCK_COUNT;
             size_t l0_len = l0_count + 1;
@@ -378,13 +1140,13 @@ class Orzo {
                 cout << endl;
                 cout << "--- l2 indices ---" << endl;
                 cout << "$$$ ef upper $$$" << endl;
-                uint32_t upper = (uint32_t) (l1l2 & EF_UPPER_BV_MASK);
-                print_bits<uint32_t>(upper, EF_UPPER_BV_COUNT);
+                uint64_t upper = (uint64_t) (l1l2 & EF_UPPER_BV_MASK);
+                print_bits<uint64_t>(upper, EF_UPPER_BV_COUNT);
                 cout << endl;
                 cout << "... ef lower ..." << endl;
-                for (size_t j = 0; j < 10; j++) {
-                    uint16_t lower = (uint16_t) (l1l2 >> (EF_UPPER_BV_COUNT + (j * EF_LOWER_ELE_COUNT)));
-                    print_bits<uint16_t>(lower, 9);
+                for (size_t j = 0; j < N_L2; j++) {
+                    uint64_t lower = (uint64_t) (l1l2 >> (EF_UPPER_BV_COUNT + (j * EF_LOWER_ELE_COUNT)));
+                    print_bits<uint64_t>(lower, EF_LOWER_ELE_COUNT);
                     cout << endl;
                 }
             }
@@ -393,4 +1155,11 @@ class Orzo {
 
 };
 
+// smaller basic blocks shorten the popcounts and scans in a basic block but
+// need more l1l2 entries, the comments give the l1l2 space per bit
+using Orzo256 = Orzo<256, 128, 10>; // 2816 bit lower blocks, 4.5%
+using Orzo512 = Orzo<512, 128, 10>; // 5632 bit lower blocks, 2.3%
+// 10 L2s of 1024 bit basic blocks would leave too few bits for l1
+using Orzo1024 = Orzo<1024, 128, 8>; // 9216 bit lower blocks, 1.4%
+
 #endif /* ORZO_H */
@@ -0,0 +1,279 @@
+#ifndef ORZO_COLLECTION_H
+#define ORZO_COLLECTION_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "allocator.h"
+#include "popcount.h"
+#include "orzo.h"
+
+/*
+ * Many bit vectors and their indices packed back to back in one arena,
+ * addressed by the id add() returns. An Orzo keeps its own object and
+ * separate l0, l1l2 and select sample arrays, and pads its bit vector to
+ * whole basic blocks, which for a bit vector of a few thousand bits costs
+ * more than the bits. Here each entry is a run of words of the arena:
+ *
+ * [ bit count | l1l2 entries, 2 words each | l0, one word per upper block | bits ]
+ *
+ * A bit vector of at most one basic block keeps no index at all, its rank is
+ * a popcount of its bits. Larger ones keep the l1l2 entry of each lower block,
+ * encoded as Orzo's, and only those spanning more than one upper block also
+ * keep l0. There are no select samples, select binary searches the lower
+ * blocks instead. The bits are stored in whole words, not basic blocks, so
+ * entries are only word aligned and small neighbours share cache lines. l1l2
+ * entries are read with memcpy for the same reason. Per bit vector that
+ * leaves the bit count word and its offset in the directory, 16 bytes.
+ *
+ * add() may move the arena, so pointers from bits() last until the next add.
+ */
+template<
+    uint64_t BASIC_BLOCK_COUNT = 512,
+    uint64_t L1L2_COUNT = 128,
+    uint64_t N_L2 = 10,
+    typename Allocator = MallocAllocator
+>
+class OrzoCollection {
+
+    private:
+
+        using Index = Orzo<BASIC_BLOCK_COUNT, L1L2_COUNT, N_L2, true, false, false, Allocator>;
+
+        static constexpr uint64_t BASIC_BLOCK_WORDS = Index::BASIC_BLOCK_WORDS;
+        static constexpr uint64_t LOWER_BLOCK_COUNT = Index::LOWER_BLOCK_COUNT;
+        static constexpr uint64_t LOWER_BLOCK_WORDS = Index::LOWER_BLOCK_WORDS;
+        static constexpr uint64_t LOWER_PER_UPPER = Index::LOWER_PER_UPPER;
+        static constexpr uint64_t UPPER_BLOCK_COUNT = Index::UPPER_BLOCK_COUNT;
+        static constexpr uint64_t EF_TOTAL_COUNT = Index::EF_TOTAL_COUNT;
+        static constexpr uint64_t L1L2_WORDS = sizeof(__uint128_t) / sizeof(uint64_t);
+        // arena words allocated by the first add
+        static constexpr uint64_t MIN_ARENA_WORDS = 4096;
+
+        uint64_t *arena = nullptr;
+        uint64_t arena_count = 0; // in words, used
+        uint64_t arena_capacity = 0; // in words, allocated
+        std::vector<uint64_t> offsets; // arena word offset of each entry
+
+        Allocator allocator;
+
+        // where the parts of an entry start, all derived from its bit count
+        struct Entry {
+            uint64_t bv_count;
+            uint64_t lower_count; // l1l2 entries, 0 for one basic block or less
+            const uint64_t *l1l2;
+            const uint64_t *l0; // nullptr within one upper block
+            const uint64_t *bits;
+        };
+
+        static uint64_t lower_count_of(uint64_t bv_count) {
+            return (bv_count > BASIC_BLOCK_COUNT) ? ((bv_count + LOWER_BLOCK_COUNT - 1) / LOWER_BLOCK_COUNT) : 0;
+        }
+
+        static uint64_t l0_count_of(uint64_t bv_count) {
+            uint64_t upper_count = (bv_count + UPPER_BLOCK_COUNT - 1) / UPPER_BLOCK_COUNT;
+            return (upper_count > 1) ? upper_count : 0;
+        }
+
+        Entry entry(uint64_t id) const {
+            const uint64_t *words = this->arena + this->offsets[id];
+            Entry e;
+            e.bv_count = words[0];
+            e.lower_count = lower_count_of(e.bv_count);
+            e.l1l2 = words + 1;
+            uint64_t l0_count = l0_count_of(e.bv_count);
+            e.l0 = (l0_count) ? (e.l1l2 + (e.lower_count * L1L2_WORDS)) : nullptr;
+            e.bits = e.l1l2 + (e.lower_count * L1L2_WORDS) + l0_count;
+            return e;
+        }
+
+        static __uint128_t load_l1l2(const Entry &e, uint64_t l1l2_idx) {
+            __uint128_t l1l2_entry;
+            memcpy(&l1l2_entry, e.l1l2 + (l1l2_idx * L1L2_WORDS), sizeof(l1l2_entry));
+            return l1l2_entry;
+        }
+
+        // number of ones before lower block l1l2_idx of e, from l0 and l1 alone
+        static uint64_t lower_block_rank(const Entry &e, uint64_t l1l2_idx) {
+            uint64_t rank = (uint64_t) (load_l1l2(e, l1l2_idx) >> EF_TOTAL_COUNT);
+            return (e.l0) ? (rank + e.l0[l1l2_idx / LOWER_PER_UPPER]) : rank;
+        }
+
+        void reserve_more(uint64_t words) {
+            if ((this->arena_count + words) <= this->arena_capacity) {
+                return;
+            }
+            this->reserve(std::max({this->arena_count + words, 2 * this->arena_capacity, MIN_ARENA_WORDS}));
+        }
+
+    public:
+
+        OrzoCollection(Allocator allocator = Allocator()) : allocator(allocator) {}
+
+        OrzoCollection(const OrzoCollection&) = delete;
+        OrzoCollection &operator=(const OrzoCollection&) = delete;
+
+        OrzoCollection(OrzoCollection &&other) noexcept
+            : arena(std::exchange(other.arena, nullptr)),
+              arena_count(std::exchange(other.arena_count, 0)),
+              arena_capacity(std::exchange(other.arena_capacity, 0)),
+              offsets(std::move(other.offsets)),
+              allocator(other.allocator) {}
+
+        ~OrzoCollection() {
+            if (this->arena) {
+                this->allocator.deallocate(this->arena, this->arena_capacity * sizeof(uint64_t));
+            }
+        }
+
+        // arena words an entry of bv_count bits takes, to size reserve()
+        static uint64_t entry_words(uint64_t bv_count) {
+            return 1 + (lower_count_of(bv_count) * L1L2_WORDS) + l0_count_of(bv_count) + ((bv_count + 63) / 64);
+        }
+
+        // grows the arena to at least words words, moving it if it grows
+        void reserve(uint64_t words) {
+            if (words <= this->arena_capacity) {
+                return;
+            }
+            uint64_t *grown = (uint64_t*) this->allocator.allocate(words * sizeof(uint64_t));
+            if (this->arena) {
+                memcpy(grown, this->arena, this->arena_count * sizeof(uint64_t));
+                this->allocator.deallocate(this->arena, this->arena_capacity * sizeof(uint64_t));
+            }
+            this->arena = grown;
+            this->arena_capacity = words;
+        }
+
+        /*
+         * Appends a copy of the first bv_count bits of bv and its index, and
+         * returns its id, ids counting up from 0. Only the words holding those
+         * bits are read, bits past bv_count in the last of them are dropped.
+         */
+        uint64_t add(const uint64_t *bv, size_t bv_count) {
+            uint64_t words = entry_words(bv_count);
+            this->reserve_more(words);
+            uint64_t lower_count = lower_count_of(bv_count);
+            uint64_t l0_count = l0_count_of(bv_count);
+            uint64_t *start = this->arena + this->arena_count;
+            uint64_t *l1l2 = start + 1;
+            uint64_t *l0 = l1l2 + (lower_count * L1L2_WORDS);
+            uint64_t *bits = l0 + l0_count;
+            start[0] = bv_count;
+            uint64_t id = this->offsets.size();
+            this->offsets.push_back(this->arena_count);
+            this->arena_count += words;
+            size_t word_count = (bv_count + 63) / 64;
+            memcpy(bits, bv, word_count * sizeof(uint64_t));
+            if (bv_count % 64) {
+                bits[word_count - 1] &= (1ull << (bv_count % 64)) - 1;
+            }
+            // as Orzo::build_lower, but basic blocks end with the bits rather
+            // than being padded to whole
+            uint64_t one_count = 0;
+            uint64_t count_within_upper = 0;
+            for (uint64_t l1l2_idx = 0; l1l2_idx < lower_count; ++l1l2_idx) {
+                if ((l1l2_idx % LOWER_PER_UPPER) == 0) {
+                    if (l0_count) {
+                        l0[l1l2_idx / LOWER_PER_UPPER] = one_count;
+                    }
+                    count_within_upper = 0;
+                }
+                uint64_t l2_counts[N_L2 + 1] = {0};
+                uint64_t count_within_lower = 0;
+                for (uint64_t k = 0; k <= N_L2; ++k) {
+                    uint64_t first = (l1l2_idx * LOWER_BLOCK_WORDS) + (k * BASIC_BLOCK_WORDS);
+                    if (first < word_count) {
+                        count_within_lower += popcount_words(bits + first, std::min(BASIC_BLOCK_WORDS, word_count - first));
+                    }
+                    l2_counts[k] = count_within_lower;
+                }
+                __uint128_t l1l2_entry = ((__uint128_t) count_within_upper << EF_TOTAL_COUNT)
+                    | Index::elias_fano_encode(l2_counts);
+                memcpy(l1l2 + (l1l2_idx * L1L2_WORDS), &l1l2_entry, sizeof(l1l2_entry));
+                count_within_upper += count_within_lower;
+                one_count += count_within_lower;
+            }
+            return id;
+        }
+
+        // number of bit vectors
+        uint64_t size() const { return this->offsets.size(); }
+
+        uint64_t bit_count(uint64_t id) const { return this->arena[this->offsets[id]]; }
+
+        // the bits of bit vector id, in whole words
+        const uint64_t *bits(uint64_t id) const { return this->entry(id).bits; }
+
+        // ones in bit vector id, from the index and the bits of its last lower block
+        uint64_t one_count(uint64_t id) const {
+            Entry e = this->entry(id);
+            if (e.lower_count == 0) {
+                return popcount_words(e.bits, (e.bv_count + 63) / 64);
+            }
+            uint64_t last = e.lower_count - 1;
+            uint64_t first = last * LOWER_BLOCK_WORDS;
+            return lower_block_rank(e, last) + popcount_words(e.bits + first, ((e.bv_count + 63) / 64) - first);
+        }
+
+        // bytes of the arena in use and of the directory
+        uint64_t space_usage() const {
+            return (this->arena_count + this->offsets.size()) * sizeof(uint64_t);
+        }
+
+        bool access(uint64_t id, uint64_t i) const {
+            const uint64_t *bits = this->entry(id).bits;
+            return (bits[i / 64] >> (i % 64)) & 1;
+        }
+
+        // ones in [0, i) of bit vector id, i < bit_count(id)
+        uint64_t rank1(uint64_t id, uint64_t i) const {
+            Entry e = this->entry(id);
+            if (e.lower_count == 0) {
+                return popcount_prefix(e.bits, i);
+            }
+            uint64_t l1l2_idx = i / LOWER_BLOCK_COUNT;
+            // distance into lower block in bits, [0, LOWER_BLOCK_COUNT)
+            uint64_t j = i - (l1l2_idx * LOWER_BLOCK_COUNT);
+            __uint128_t l1l2_entry = load_l1l2(e, l1l2_idx);
+            uint64_t rank = (uint64_t) (l1l2_entry >> EF_TOTAL_COUNT) + Index::l2_rank(l1l2_entry, j / BASIC_BLOCK_COUNT);
+            if (e.l0) {
+                rank += e.l0[i / UPPER_BLOCK_COUNT];
+            }
+            const uint64_t *words = e.bits + (l1l2_idx * LOWER_BLOCK_WORDS) + ((j / BASIC_BLOCK_COUNT) * BASIC_BLOCK_WORDS);
+            return rank + popcount_prefix(words, j % BASIC_BLOCK_COUNT);
+        }
+
+        uint64_t rank0(uint64_t id, uint64_t i) const {
+            return i - this->rank1(id, i);
+        }
+
+        // position of the i-th one of bit vector id, 1-based like Orzo::select1,
+        // i <= one_count(id)
+        uint64_t select1(uint64_t id, uint64_t i) const {
+            Entry e = this->entry(id);
+            if (e.lower_count == 0) {
+                return Index::select1_in_block(e.bits, 0, i);
+            }
+            // the last lower block with fewer than i ones before it
+            uint64_t lo = 0;
+            uint64_t hi = e.lower_count;
+            while ((hi - lo) > 1) {
+                uint64_t mid = lo + ((hi - lo) / 2);
+                if (lower_block_rank(e, mid) < i) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+            uint64_t rank = i - lower_block_rank(e, lo);
+            uint64_t l2 = 0;
+            uint64_t idx = Index::select1_scan_l2(load_l1l2(e, lo), rank, l2);
+            return Index::select1_in_block(e.bits, (lo * LOWER_BLOCK_WORDS) + (idx * BASIC_BLOCK_WORDS), rank - l2);
+        }
+
+};
+
+#endif /* ORZO_COLLECTION_H */
@@ -0,0 +1,107 @@
+#ifndef ORZO_VIEW_H
+#define ORZO_VIEW_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include "orzo.h"
+#include "bitvector.h"
+
+/*
+ * A read-only pairing of a bit vector and its index, for serving queries from
+ * many threads. Both are fixed once the constructor returns: the index is held
+ * const, and the bit vector is either owned by the view (moved in, or mapped
+ * from a file written by Orzo::save) or borrowed, in which case the caller
+ * must keep it alive and unchanged for the life of the view. The query methods
+ * are const and only ever read, so any number of threads may call them on
+ * the same view at once without synchronisation.
+ *
+ * Index may be any of the static indexes (Orzo, EliasFanoOrzo,
+ * CompressedOrzo, AutoOrzo). DynamicOrzo's queries flush pending updates, so
+ * they cannot be called on a const index and a view of one does not compile
+ * once queried.
+ */
+template<typename Index = Orzo<>, typename Bitvector = OrzoBitvector<>>
+class OrzoView {
+
+    private:
+
+        std::optional<Bitvector> owned_bv; // set when the view owns the bits
+        const uint64_t *bv;
+        const Index index;
+
+        // takes over an index loaded by Index::map, which owns its bits
+        explicit OrzoView(Index &&mapped) : bv(mapped.mapped_data()), index(std::move(mapped)) {}
+
+    public:
+
+        // borrows bv, which must outlive the view and not change
+        OrzoView(
+            const uint64_t *bv,
+            size_t bv_count,
+            size_t num_threads = std::thread::hardware_concurrency()
+        ) : bv(bv), index(bv, bv_count, num_threads) {}
+
+        // owns bits, built with the padding the index reads (ex. 5632 bits)
+        OrzoView(
+            Bitvector &&bits,
+            size_t bv_count,
+            size_t num_threads = std::thread::hardware_concurrency()
+        ) : owned_bv(std::move(bits)), bv(this->owned_bv->data()), index(this->bv, bv_count, num_threads) {}
+
+        // owns an index and bit vector mapped from a file written by save()
+        static OrzoView map(const std::string &path) {
+            return OrzoView(Index::map(path));
+        }
+
+        // queries hold pointers into the view, so it stays where it was built
+        OrzoView(const OrzoView&) = delete;
+        OrzoView &operator=(const OrzoView&) = delete;
+
+        const Index &get_index() const { return this->index; }
+        const uint64_t *data() const { return this->bv; }
+        uint64_t get_one_count() const { return this->index.get_one_count(); }
+
+        uint64_t rank1(uint64_t i) const {
+            return this->index.rank1(this->bv, i);
+        }
+
+        uint64_t rank0(uint64_t i) const {
+            return this->index.rank0(this->bv, i);
+        }
+
+        uint64_t select1(uint64_t i) const {
+            return this->index.select1(this->bv, i);
+        }
+
+        uint64_t select0(uint64_t i) const {
+            return this->index.select0(this->bv, i);
+        }
+
+        // batched queries as in Orzo, each thread batches its own queries
+        void rank1_batch(const uint64_t *positions, uint64_t *out, size_t n) const {
+            this->index.rank1_batch(this->bv, positions, out, n);
+        }
+
+        void select1_batch(const uint64_t *ranks, uint64_t *out, size_t n) const {
+            this->index.select1_batch(this->bv, ranks, out, n);
+        }
+
+        // enumeration as in Orzo
+        size_t select_range(uint64_t r_begin, uint64_t r_end, uint64_t *out) const {
+            return this->index.select_range(this->bv, r_begin, r_end, out);
+        }
+
+        OneRange ones(uint64_t i = 1) const {
+            return this->index.ones(this->bv, i);
+        }
+
+        void rank1_sorted(const uint64_t *positions, uint64_t *out, size_t n) const {
+            this->index.rank1_sorted(this->bv, positions, out, n);
+        }
+
+};
+
+#endif /* ORZO_VIEW_H */
@@ -0,0 +1,148 @@
+#ifndef POPCOUNT_H
+#define POPCOUNT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <bit>
+#include <immintrin.h>
+
+/*
+ * Popcount kernels used for construction (popcount_words over a basic block)
+ * and for the in-block step of rank (popcount_prefix over the bits of a basic
+ * block before the queried position). The kernel is picked at compile time
+ * from the target flags, AVX-512 VPOPCNTDQ first, then AVX2, then scalar
+ * popcnt. Defining ORZO_POPCOUNT_SCALAR or ORZO_POPCOUNT_AVX2 forces a kernel
+ * (ex. to compare them on the same machine).
+ */
+#if !defined(ORZO_POPCOUNT_SCALAR) && !defined(ORZO_POPCOUNT_AVX2) && !defined(ORZO_POPCOUNT_AVX512)
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+#define ORZO_POPCOUNT_AVX512
+#elif defined(__AVX2__)
+#define ORZO_POPCOUNT_AVX2
+#else
+#define ORZO_POPCOUNT_SCALAR
+#endif
+#endif
+
+#if defined(ORZO_POPCOUNT_AVX512)
+
+inline uint64_t popcount_words(const uint64_t *words, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; (i + 8) <= n; i += 8) {
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+    }
+    if (i < n) {
+        __mmask8 tail = (__mmask8) ((1u << (n - i)) - 1);
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_maskz_loadu_epi64(tail, words + i)));
+    }
+    return (uint64_t) _mm512_reduce_add_epi64(acc);
+}
+
+// popcount of the first bits bits of words, only the words holding them are read
+inline uint64_t popcount_prefix(const uint64_t *words, uint64_t bits) {
+    const __m512i ones = _mm512_set1_epi64(-1);
+    const __m512i offsets = _mm512_setr_epi64(0, 64, 128, 192, 256, 320, 384, 448);
+    __m512i acc = _mm512_setzero_si512();
+    size_t n = (bits + 63) / 64;
+    for (size_t i = 0; i < n; i += 8) {
+        // bits of each lane before the end of the prefix, clamped to [0, 64]
+        __m512i lane_bits = _mm512_sub_epi64(_mm512_set1_epi64(bits - (i * 64)), offsets);
+        lane_bits = _mm512_min_epi64(_mm512_max_epi64(lane_bits, _mm512_setzero_si512()), _mm512_set1_epi64(64));
+        __mmask8 load = _mm512_cmpgt_epi64_mask(lane_bits, _mm512_setzero_si512());
+        // shifting by 64 clears a lane entirely
+        __m512i mask = _mm512_srlv_epi64(ones, _mm512_sub_epi64(_mm512_set1_epi64(64), lane_bits));
+        __m512i v = _mm512_and_si512(_mm512_maskz_loadu_epi64(load, words + i), mask);
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(v));
+    }
+    return (uint64_t) _mm512_reduce_add_epi64(acc);
+}
+
+#elif defined(ORZO_POPCOUNT_AVX2)
+
+// per 64-bit lane popcount via a nibble lookup with vpshufb (Mula et al.)
+inline __m256i popcount_epi64_avx2(__m256i v) {
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+    );
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i counts = _mm256_add_epi8(
+        _mm256_shuffle_epi8(lookup, lo),
+        _mm256_shuffle_epi8(lookup, hi)
+    );
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+inline uint64_t reduce_add_epi64_avx2(__m256i v) {
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    return (uint64_t) (_mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1));
+}
+
+inline uint64_t popcount_words(const uint64_t *words, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t vector_count = n - (n % 4);
+    for (size_t i = 0; i < vector_count; i += 4) {
+        acc = _mm256_add_epi64(acc, popcount_epi64_avx2(_mm256_loadu_si256((const __m256i*) (words + i))));
+    }
+    uint64_t count = reduce_add_epi64_avx2(acc);
+    // bounded by n % 4 rather than n, which gcc can't tell the loop above left < 4
+    for (size_t i = 0; i < (n % 4); ++i) {
+        count += (uint64_t) std::popcount(words[vector_count + i]);
+    }
+    return count;
+}
+
+// popcount of the first bits bits of words, only the words holding them are read
+inline uint64_t popcount_prefix(const uint64_t *words, uint64_t bits) {
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i offsets = _mm256_setr_epi64x(0, 64, 128, 192);
+    __m256i acc = zero;
+    size_t n = (bits + 63) / 64;
+    for (size_t i = 0; i < n; i += 4) {
+        // bits of each lane before the end of the prefix, may be out of [0, 64]
+        __m256i lane_bits = _mm256_sub_epi64(_mm256_set1_epi64x(bits - (i * 64)), offsets);
+        __m256i load = _mm256_cmpgt_epi64(lane_bits, zero);
+        // shifting by 64 or more clears a lane, a negative shift means keep it all
+        __m256i shift = _mm256_sub_epi64(_mm256_set1_epi64x(64), lane_bits);
+        shift = _mm256_andnot_si256(_mm256_cmpgt_epi64(zero, shift), shift);
+        __m256i mask = _mm256_srlv_epi64(ones, shift);
+        __m256i v = _mm256_maskload_epi64((const long long*) (words + i), load);
+        acc = _mm256_add_epi64(acc, popcount_epi64_avx2(_mm256_and_si256(v, mask)));
+    }
+    return reduce_add_epi64_avx2(acc);
+}
+
+#else
+
+inline uint64_t popcount_words(const uint64_t *words, size_t n) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        count += (uint64_t) std::popcount(words[i]);
+    }
+    return count;
+}
+
+// popcount of the first bits bits of words, only the words holding them are read
+inline uint64_t popcount_prefix(const uint64_t *words, uint64_t bits) {
+    uint64_t count = 0;
+    uint64_t num_popcounts = bits / 64;
+    // full popcounts
+    uint64_t i = 0;
+    for (; i < num_popcounts; ++i) {
+        count += (uint64_t) std::popcount(words[i]);
+    }
+    // partial popcount
+    bits %= 64;
+    if (bits) {
+        count += (uint64_t) std::popcount(words[i] << (64 - bits));
+    }
+    return count;
+}
+
+#endif
+
+#endif /* POPCOUNT_H */
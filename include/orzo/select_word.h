@@ -0,0 +1,129 @@
+#ifndef SELECT_WORD_H
+#define SELECT_WORD_H
+
+#include <cstdint>
+#include <bit>
+#include <immintrin.h>
+
+/*
+ * select_in_word(x, k) is the position of the (k + 1)-th set bit of x, k <
+ * popcount(x). It finishes every select and decodes the unary elias-fano
+ * upper bits of the l2s, so it runs at least once on every rank and select.
+ * Kernels:
+ *
+ * - pdep: tzcnt(pdep(1 << k, x)), a few cycles where pdep is done in
+ *   hardware, but microcoded and around 50x slower on AMD Zen 1 and Zen 2
+ * - broadword: byte popcounts summed by a multiply, the byte holding the
+ *   answer found by comparing all eight prefix sums at once, then the same
+ *   again over the bits of that byte (Vigna's broadword select)
+ * - table: the byte found as in broadword, the bit then looked up in a 2 KiB
+ *   table of the k-th set bit of every byte
+ *
+ * The kernel is picked at compile time, pdep if the target has BMI2 and
+ * broadword otherwise. Defining ORZO_SELECT_PDEP, ORZO_SELECT_BROADWORD or
+ * ORZO_SELECT_TABLE forces one (make SELECT=...), ex. broadword for a -mbmi2
+ * build run on Zen 2. ORZO_SELECT_DISPATCH instead checks the CPU once at
+ * startup and takes pdep only where it is fast, between pdep and broadword,
+ * on one well predicted branch.
+ */
+#if !defined(ORZO_SELECT_PDEP) && !defined(ORZO_SELECT_BROADWORD) && !defined(ORZO_SELECT_TABLE) && !defined(ORZO_SELECT_DISPATCH)
+#if defined(__BMI2__)
+#define ORZO_SELECT_PDEP
+#else
+#define ORZO_SELECT_BROADWORD
+#endif
+#endif
+
+constexpr uint64_t ONES_STEP_8 = 0x0101010101010101ULL;
+constexpr uint64_t MSBS_STEP_8 = 0x8080808080808080ULL;
+
+// bytes of sums, eight byte values below 128, that are at most k (k < 128)
+inline uint64_t bytes_at_most(uint64_t sums, uint64_t k) {
+    return (uint64_t) std::popcount((((k * ONES_STEP_8) | MSBS_STEP_8) - sums) & MSBS_STEP_8);
+}
+
+// bit offset of the byte of x holding its (k + 1)-th set bit, k is left as
+// the rank of that bit within its byte
+inline uint64_t select_byte(uint64_t x, uint64_t &k) {
+    uint64_t sums = x - ((x >> 1) & 0x5555555555555555ULL);
+    sums = (sums & 0x3333333333333333ULL) + ((sums >> 2) & 0x3333333333333333ULL);
+    sums = ((sums + (sums >> 4)) & 0x0F0F0F0F0F0F0F0FULL) * ONES_STEP_8;
+    // byte b of sums is the number of ones in bytes 0 through b
+    uint64_t place = bytes_at_most(sums, k) * 8;
+    k -= ((sums << 8) >> place) & 0xFF;
+    return place;
+}
+
+inline uint64_t select_in_word_broadword(uint64_t x, uint64_t k) {
+    uint64_t place = select_byte(x, k);
+    // byte j of spread is bit j of the byte alone, 0 or 1
+    uint64_t spread = (((x >> place) & 0xFF) * ONES_STEP_8) & 0x8040201008040201ULL;
+    spread = ((spread | ((spread & ~MSBS_STEP_8) + ~MSBS_STEP_8)) & MSBS_STEP_8) >> 7;
+    return place + bytes_at_most(spread * ONES_STEP_8, k);
+}
+
+// SELECT_IN_BYTE[(k << 8) | byte] is the position of the (k + 1)-th set bit
+// of byte, 8 where the byte has no such bit
+inline constexpr auto SELECT_IN_BYTE = [] {
+    struct { uint8_t at[8 * 256]; } table{};
+    for (uint64_t byte = 0; byte < 256; ++byte) {
+        uint64_t k = 0;
+        for (uint64_t bit = 0; bit < 8; ++bit) {
+            if ((byte >> bit) & 1) {
+                table.at[(k++ << 8) | byte] = (uint8_t) bit;
+            }
+        }
+        for (; k < 8; ++k) {
+            table.at[(k << 8) | byte] = 8;
+        }
+    }
+    return table;
+}();
+
+inline uint64_t select_in_word_table(uint64_t x, uint64_t k) {
+    uint64_t place = select_byte(x, k);
+    return place + SELECT_IN_BYTE.at[(k << 8) | ((x >> place) & 0xFF)];
+}
+
+#if defined(ORZO_SELECT_PDEP) || defined(ORZO_SELECT_DISPATCH)
+
+__attribute__((target("bmi,bmi2")))
+inline uint64_t select_in_word_pdep(uint64_t x, uint64_t k) {
+    return _tzcnt_u64(_pdep_u64(1ULL << k, x));
+}
+
+#endif
+
+#if defined(ORZO_SELECT_DISPATCH)
+
+// pdep is microcoded on AMD before Zen 3
+inline const bool ORZO_FAST_PDEP = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("znver1") && !__builtin_cpu_is("znver2");
+}();
+
+inline uint64_t select_in_word(uint64_t x, uint64_t k) {
+    return (ORZO_FAST_PDEP) ? select_in_word_pdep(x, k) : select_in_word_broadword(x, k);
+}
+
+#elif defined(ORZO_SELECT_PDEP)
+
+inline uint64_t select_in_word(uint64_t x, uint64_t k) {
+    return select_in_word_pdep(x, k);
+}
+
+#elif defined(ORZO_SELECT_TABLE)
+
+inline uint64_t select_in_word(uint64_t x, uint64_t k) {
+    return select_in_word_table(x, k);
+}
+
+#else
+
+inline uint64_t select_in_word(uint64_t x, uint64_t k) {
+    return select_in_word_broadword(x, k);
+}
+
+#endif
+
+#endif /* SELECT_WORD_H */
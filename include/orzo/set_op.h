@@ -0,0 +1,117 @@
+#ifndef SET_OP_H
+#define SET_OP_H
+
+#include <cstdint>
+#include <cstddef>
+#include <bit>
+#include <immintrin.h>
+#include "popcount.h"
+
+// bitwise set operations Orzo::combine builds an indexed result of
+enum class SetOp { AND, OR, XOR, ANDNOT };
+
+// ANDNOT is a & ~b, the ones of a not in b
+template<SetOp op>
+inline uint64_t apply_set_op(uint64_t a, uint64_t b) {
+    if constexpr(op == SetOp::AND) {
+        return a & b;
+    } else if constexpr(op == SetOp::OR) {
+        return a | b;
+    } else if constexpr(op == SetOp::XOR) {
+        return a ^ b;
+    } else {
+        return a & ~b;
+    }
+}
+
+/*
+ * Writes op of the first n words of a and b to out and returns the number of
+ * ones written, popcounted from registers so out is never read back. Vectors
+ * as wide as the popcount kernel picked in popcount.h, scalar otherwise.
+ * Every op maps zero words to zero, so zero padding past the end of a and b
+ * stays zero in out.
+ */
+#if defined(ORZO_POPCOUNT_AVX512)
+
+template<SetOp op>
+inline __m512i apply_set_op_epi64(__m512i a, __m512i b) {
+    if constexpr(op == SetOp::AND) {
+        return _mm512_and_si512(a, b);
+    } else if constexpr(op == SetOp::OR) {
+        return _mm512_or_si512(a, b);
+    } else if constexpr(op == SetOp::XOR) {
+        return _mm512_xor_si512(a, b);
+    } else {
+        return _mm512_andnot_si512(b, a);
+    }
+}
+
+template<SetOp op>
+inline uint64_t combine_words(const uint64_t *a, const uint64_t *b, uint64_t *out, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t vector_words = n - (n % 8);
+    size_t i = 0;
+    for (; i < vector_words; i += 8) {
+        __m512i v = apply_set_op_epi64<op>(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        _mm512_storeu_si512(out + i, v);
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(v));
+    }
+    uint64_t count = (uint64_t) _mm512_reduce_add_epi64(acc);
+    for (; i < n; ++i) {
+        out[i] = apply_set_op<op>(a[i], b[i]);
+        count += (uint64_t) std::popcount(out[i]);
+    }
+    return count;
+}
+
+#elif defined(ORZO_POPCOUNT_AVX2)
+
+template<SetOp op>
+inline __m256i apply_set_op_epi64(__m256i a, __m256i b) {
+    if constexpr(op == SetOp::AND) {
+        return _mm256_and_si256(a, b);
+    } else if constexpr(op == SetOp::OR) {
+        return _mm256_or_si256(a, b);
+    } else if constexpr(op == SetOp::XOR) {
+        return _mm256_xor_si256(a, b);
+    } else {
+        return _mm256_andnot_si256(b, a);
+    }
+}
+
+template<SetOp op>
+inline uint64_t combine_words(const uint64_t *a, const uint64_t *b, uint64_t *out, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t vector_words = n - (n % 4);
+    size_t i = 0;
+    for (; i < vector_words; i += 4) {
+        __m256i v = apply_set_op_epi64<op>(
+            _mm256_loadu_si256((const __m256i*) (a + i)),
+            _mm256_loadu_si256((const __m256i*) (b + i))
+        );
+        _mm256_storeu_si256((__m256i*) (out + i), v);
+        acc = _mm256_add_epi64(acc, popcount_epi64_avx2(v));
+    }
+    uint64_t count = reduce_add_epi64_avx2(acc);
+    for (; i < n; ++i) {
+        out[i] = apply_set_op<op>(a[i], b[i]);
+        count += (uint64_t) std::popcount(out[i]);
+    }
+    return count;
+}
+
+#else
+
+template<SetOp op>
+inline uint64_t combine_words(const uint64_t *a, const uint64_t *b, uint64_t *out, size_t n) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = apply_set_op<op>(a[i], b[i]);
+        count += (uint64_t) std::popcount(out[i]);
+    }
+    return count;
+}
+
+#endif
+
+#endif /* SET_OP_H */
@@ -0,0 +1,180 @@
+#ifndef STREAMING_ORZO_H
+#define STREAMING_ORZO_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include "orzo.h"
+
+/*
+ * Builds an Orzo index while the bit vector is still arriving. Words are
+ * appended with push_words(), and every time a lower block fills up it is
+ * sealed: its l1l2 entry is encoded, l0 is extended and the select samples
+ * landing in it are placed, all without looking at anything sealed before. Queries (the usual Orzo ones, on mapped_data()) answer for
+ * the sealed prefix, the first sealed_count() bits, and may be interleaved
+ * with pushes. Running them on other threads while pushes continue needs the
+ * caller to synchronise the two (ex. with a std::shared_mutex). finalize()
+ * seals the last, partial lower block and ends the stream.
+ *
+ * The bits and every index array live in one region of address space that
+ * is reserved up front for capacity bits but only backed by memory as it is
+ * written, so arrays never move or get copied as they grow, and resident
+ * memory is never more than that of the final index. The select sample
+ * arrays are reserved for a sample every SELECT_SAMPLE bits of capacity, of
+ * which only the pages actually used are ever touched. Since that region is
+ * mapped here rather than allocated, there is no allocator policy to choose.
+ */
+template<
+    uint64_t BASIC_BLOCK_COUNT = 512,
+    uint64_t L1L2_COUNT = 128,
+    uint64_t N_L2 = 10,
+    bool use_l0 = true,
+    bool support_select = true,
+    bool support_select0 = false
+>
+class StreamingOrzo : public Orzo<BASIC_BLOCK_COUNT, L1L2_COUNT, N_L2, use_l0, support_select, support_select0> {
+
+    private:
+
+        using Base = Orzo<BASIC_BLOCK_COUNT, L1L2_COUNT, N_L2, use_l0, support_select, support_select0>;
+
+        uint64_t capacity_words;
+        uint64_t num_words = 0; // pushed so far
+        uint64_t count_within_upper = 0;
+        uint64_t zero_count = 0; // in the sealed prefix
+        // samples placed so far, indexed by whether they are of zeros
+        uint64_t num_samples[2] = {0, 0};
+        bool finalized = false;
+
+        // places the samples of lower block l1l2_idx, which holds count ones
+        // (zeros) with count_before before it
+        template<bool zeros>
+        void place_samples(size_t l1l2_idx, uint64_t count_before, uint64_t count) {
+            uint32_t *samples = (zeros) ? this->select0_samples : this->select_samples;
+            uint64_t &sample_count = (zeros) ? this->SELECT0_SAMPLE_COUNT : this->SELECT_SAMPLE_COUNT;
+            uint64_t &num = this->num_samples[zeros];
+            while (((num * Base::SELECT_SAMPLE) + 1) <= (count_before + count)) {
+                samples[num++] = (uint32_t) l1l2_idx;
+            }
+            sample_count = std::max<uint64_t>(1, num);
+        }
+
+        // seals lower block L1L2_INDEX_COUNT, which holds block_count bits.
+        // num_basic_blocks bounds the bits read for a partial last lower block
+        void seal_lower(size_t num_basic_blocks, uint64_t block_count) {
+            size_t l1l2_idx = this->L1L2_INDEX_COUNT;
+            size_t upper_idx = l1l2_idx / this->LOWER_PER_UPPER;
+            if ((l1l2_idx % this->LOWER_PER_UPPER) == 0) {
+                this->l0[upper_idx] = this->one_count;
+                this->count_within_upper = 0;
+            }
+            uint64_t count = this->build_lower(this->mapped_bv, l1l2_idx, num_basic_blocks, this->count_within_upper);
+            this->count_within_upper += count;
+            this->one_count += count;
+            this->l0[upper_idx + 1] = this->one_count;
+            if constexpr(support_select) {
+                this->template place_samples<false>(l1l2_idx, this->one_count - count, count);
+            }
+            if constexpr(support_select0) {
+                this->template place_samples<true>(l1l2_idx, this->zero_count, block_count - count);
+            }
+            this->zero_count += block_count - count;
+            // publish the lower block last
+            this->L1L2_INDEX_COUNT = l1l2_idx + 1;
+            this->bv_count = this->L1L2_INDEX_COUNT * Base::LOWER_BLOCK_COUNT;
+        }
+
+    public:
+
+        // reserves (but does not back with memory) room for capacity bits
+        StreamingOrzo(uint64_t capacity) {
+            uint64_t num_lower_blocks = std::max<uint64_t>(1, (capacity + Base::LOWER_BLOCK_COUNT - 1) / Base::LOWER_BLOCK_COUNT);
+            this->capacity_words = num_lower_blocks * Base::LOWER_BLOCK_WORDS;
+            uint64_t max_samples = Base::select_sample_count(this->capacity_words * 64);
+            if ((support_select || support_select0) && ((this->capacity_words * 64) > Base::MAX_SELECT_BV_COUNT)) {
+                throw std::length_error("orzo: select supports at most "
+                    + std::to_string(Base::MAX_SELECT_BV_COUNT) + " bits");
+            }
+            // laid out like a saved index at full capacity
+            uint64_t sizes[ORZO_SECTION_COUNT];
+            Base::section_sizes(this->capacity_words * 64, num_lower_blocks,
+                (support_select) ? max_samples : 0, (support_select0) ? max_samples : 0, sizes);
+            uint64_t offsets[ORZO_SECTION_COUNT];
+            uint64_t len = 0;
+            for (uint64_t i = 0; i < ORZO_SECTION_COUNT; ++i) {
+                offsets[i] = len;
+                len += round_up(sizes[i], ORZO_SECTION_ALIGNMENT);
+            }
+            void *region = mmap(
+                nullptr, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+            );
+            if (region == MAP_FAILED) {
+                throw std::runtime_error("orzo: cannot reserve " + std::to_string(len) + " bytes for streaming");
+            }
+            // owned like a mapped index, so the Orzo destructor unmaps it
+            this->mapping = region;
+            this->mapping_size = len;
+            auto section = [&](OrzoSectionId id) {
+                return sizes[id] ? (void*) ((char*) region + offsets[id]) : nullptr;
+            };
+            this->bv_count = 0;
+            this->one_count = 0;
+            this->L1L2_INDEX_COUNT = 0;
+            this->mapped_bv = (uint64_t*) section(ORZO_SECTION_BV);
+            this->l0 = (uint64_t*) section(ORZO_SECTION_L0);
+            this->l1l2 = (__uint128_t*) section(ORZO_SECTION_L1L2);
+            this->select_samples = (uint32_t*) section(ORZO_SECTION_SELECT_SAMPLES);
+            this->select0_samples = (uint32_t*) section(ORZO_SECTION_SELECT0_SAMPLES);
+        }
+
+        // appends n words, sealing every lower block they complete
+        void push_words(const uint64_t *words, size_t n) {
+            if (this->finalized) {
+                throw std::runtime_error("orzo: push_words after finalize");
+            }
+            if (n > (this->capacity_words - this->num_words)) {
+                throw std::runtime_error("orzo: streaming capacity of "
+                    + std::to_string(this->capacity_words * 64) + " bits exceeded");
+            }
+            memcpy(&(this->mapped_bv[this->num_words]), words, n * sizeof(uint64_t));
+            this->num_words += n;
+            while (((this->L1L2_INDEX_COUNT + 1) * Base::LOWER_BLOCK_WORDS) <= this->num_words) {
+                this->seal_lower(SIZE_MAX, Base::LOWER_BLOCK_COUNT);
+            }
+        }
+
+        /*
+         * Seals the words pushed after the last whole lower block and ends the
+         * stream. bv_count is the final length in bits, by default every
+         * pushed bit; any bits pushed past it must be zero. It cannot cut into
+         * the lower blocks already sealed, whose zeros are already counted.
+         */
+        void finalize(uint64_t bv_count = UINT64_MAX) {
+            if (this->finalized) {
+                return;
+            }
+            if (bv_count < this->sealed_count()) {
+                throw std::runtime_error("orzo: finalize at " + std::to_string(bv_count)
+                    + " bits, before the " + std::to_string(this->sealed_count()) + " already sealed");
+            }
+            bv_count = std::min<uint64_t>(bv_count, this->num_words * 64);
+            // words pushed past bv_count hold no bits, so only seal if some
+            // of the bits are past the last whole lower block
+            if (bv_count > (this->L1L2_INDEX_COUNT * Base::LOWER_BLOCK_COUNT)) {
+                uint64_t block_count = bv_count - (this->L1L2_INDEX_COUNT * Base::LOWER_BLOCK_COUNT);
+                this->seal_lower((bv_count + BASIC_BLOCK_COUNT - 1) / BASIC_BLOCK_COUNT, block_count);
+            }
+            this->bv_count = bv_count;
+            this->finalized = true;
+        }
+
+        // number of leading bits that queries can be asked about
+        uint64_t sealed_count() { return this->bv_count; }
+
+};
+
+#endif /* STREAMING_ORZO_H */
@@ -2,10 +2,14 @@
 #define UTILS_H
 
 #include <functional>
+#include <algorithm>
 #include <random>
 #include <chrono>
 #include <iostream>
 #include <bit>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 double benchmark(std::function<void(void)> cb) {
     auto start = std::chrono::high_resolution_clock::now();
@@ -15,6 +19,33 @@ double benchmark(std::function<void(void)> cb) {
     return elapsed_seconds.count();
 }
 
+// calls cb(i) for every i in [0, count) on up to num_threads threads, workers
+// take the next unclaimed index from a shared counter so uneven work balances
+inline void parallel_for(size_t count, size_t num_threads, std::function<void(size_t)> cb) {
+    num_threads = std::clamp<size_t>(num_threads, 1, std::max<size_t>(count, 1));
+    if (num_threads == 1) {
+        for (size_t i = 0; i < count; ++i) {
+            cb(i);
+        }
+        return;
+    }
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count) {
+            cb(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < num_threads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
 template<typename T>
 T random_real(T a, T b) {
     static std::random_device dev;
@@ -0,0 +1,334 @@
+#ifndef WAVELET_MATRIX_H
+#define WAVELET_MATRIX_H
+
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include <bit>
+#include <thread>
+#include <vector>
+#include <immintrin.h>
+#include "utils.h"
+#include "allocator.h"
+#include "orzo.h"
+
+/*
+ * A wavelet matrix over a sequence of n integer symbols of LEVEL_COUNT bits,
+ * one Orzo indexed bit vector per bit of the symbols, most significant first.
+ * Level l holds bit l of every symbol, ordered by a stable sort of the
+ * symbols on their l leading bits with the zeros of each level going before
+ * its ones, so a position at level l moves to rank0 (for a 0) or zeros[l] +
+ * rank1 (for a 1) at the level below. access, rank and range_quantile walk
+ * down the levels, select walks down then back up with select1/select0.
+ *
+ * The levels are laid out back to back in one allocation, each padded to
+ * whole basic blocks, which are what the index kernels read, and followed by
+ * the l0, l1l2 and select sample arrays of every level's index. The ones of
+ * a level are the symbols with its bit set, whatever their order, so every
+ * array size is known before any level is built and LevelAllocator hands
+ * the indices their slices of the same arena. Every step down
+ * is a rank1 whose result decides where the next level is read. The basic
+ * block rank at a level comes from the index alone and lands within a basic
+ * block of the exact rank. So once it is known, the l1l2 entries and basic
+ * blocks the next level will need are prefetched for both branches, while the
+ * bit vector line of the current level is still on its way. The next level's
+ * index misses then overlap the current level's bit vector miss rather than
+ * following it. access_batch goes further and walks a batch of queries down
+ * together, the next level of each prefetched exactly.
+ */
+template<typename Allocator = MallocAllocator>
+class WaveletMatrix {
+
+    public:
+
+        /*
+         * Allocation policy of the levels' indices, consecutive 64 byte
+         * aligned slices of the arena, which is zeroed and freed as a whole
+         * by the WaveletMatrix.
+         */
+        class LevelAllocator {
+
+            private:
+
+                char **cursor = nullptr;
+
+            public:
+
+                LevelAllocator() = default;
+                LevelAllocator(char **cursor) : cursor(cursor) {}
+
+                void *allocate(size_t bytes) {
+                    void *ptr = *this->cursor;
+                    *this->cursor += round_up(bytes, 64);
+                    return ptr;
+                }
+
+                void deallocate(void*, size_t) {}
+
+        };
+
+        // select0 is needed to walk select back up through 0 bits
+        using Index = Orzo<512, 128, 10, true, true, true, LevelAllocator>;
+
+    private:
+
+        // levels are padded to whole 512 bit basic blocks
+        static constexpr uint64_t LEVEL_ALIGN_WORDS = 512 / 64;
+        // queries access_batch walks down the levels together
+        static constexpr uint64_t BATCH_SIZE = 32;
+
+        uint64_t n = 0;
+        uint64_t LEVEL_COUNT = 0;
+        uint64_t level_words = 0;
+        uint64_t *bits = nullptr; // the start of the arena
+        uint64_t arena_bytes = 0;
+        char *arena_cursor = nullptr; // where LevelAllocator hands out next
+        std::vector<Index> levels;
+        std::vector<uint64_t> zeros; // zeros of each level, where its ones start below
+
+        Allocator allocator;
+
+        // bytes LevelAllocator hands out for the index of a level of n bits
+        // holding one_count ones
+        static uint64_t level_index_bytes(uint64_t n, uint64_t one_count) {
+            uint64_t sizes[ORZO_SECTION_COUNT];
+            Index::section_sizes(n, (n + Index::LOWER_BLOCK_COUNT - 1) / Index::LOWER_BLOCK_COUNT,
+                Index::select_sample_count(one_count), Index::select_sample_count(n - one_count), sizes);
+            uint64_t bytes = 0;
+            for (uint64_t id = ORZO_SECTION_L0; id < ORZO_SECTION_COUNT; ++id) {
+                bytes += round_up(sizes[id], 64);
+            }
+            return bytes;
+        }
+
+        const uint64_t *level_bv(uint64_t l) const {
+            return this->bits + (l * this->level_words);
+        }
+
+        bool get_bit(uint64_t l, uint64_t i) const {
+            return (this->level_bv(l)[i / 64] >> (i % 64)) & 1;
+        }
+
+        // rank1 at level l, i up to and including n, which the index itself
+        // would read past its last lower block for
+        uint64_t level_rank1(uint64_t l, uint64_t i) const {
+            if (i >= this->n) {
+                return this->n - this->zeros[l];
+            }
+            return this->levels[l].rank1(this->level_bv(l), i);
+        }
+
+        // prefetches what level l + 1 reads for position i at level l, for
+        // either bit, from the basic block rank of i at level l
+        void prefetch_below(uint64_t l, uint64_t i) const {
+            if (((l + 1) >= this->LEVEL_COUNT) || (i >= this->n)) {
+                return;
+            }
+            uint64_t approx_rank = this->levels[l].basic_block_rank(i);
+            const uint64_t *next = this->level_bv(l + 1);
+            this->levels[l + 1].prefetch_rank1(next, i - approx_rank);
+            this->levels[l + 1].prefetch_rank1(next, std::min(this->zeros[l] + approx_rank, this->n - 1));
+        }
+
+        // position of i at level l + 1, given bit of level l at i
+        uint64_t descend(uint64_t l, uint64_t i, bool bit) const {
+            uint64_t ones = this->level_rank1(l, i);
+            return (bit) ? (this->zeros[l] + ones) : (i - ones);
+        }
+
+    public:
+
+        /*
+         * Builds over symbols[0, n), each taking level_count bits (by default
+         * the bit width of the largest symbol). Each level is a stable
+         * partition of the one above on its bit. The levels are indexed with
+         * num_threads each, one after the other, into the arena allocated
+         * from allocator.
+         */
+        WaveletMatrix(
+            const uint64_t *symbols,
+            size_t n,
+            uint64_t level_count = 0,
+            size_t num_threads = std::thread::hardware_concurrency(),
+            Allocator allocator = Allocator()
+        ) : n(n), allocator(allocator) {
+            if (level_count == 0) {
+                uint64_t max_symbol = 0;
+                for (size_t i = 0; i < n; ++i) {
+                    max_symbol = std::max(max_symbol, symbols[i]);
+                }
+                level_count = std::max<uint64_t>(1, std::bit_width(max_symbol));
+            }
+            this->LEVEL_COUNT = level_count;
+            this->level_words = round_up((n + 63) / 64, LEVEL_ALIGN_WORDS);
+            // level l holds the bits at shift level_count - 1 - l
+            std::vector<uint64_t> ones_at_shift(level_count, 0);
+            uint64_t symbol_mask = (level_count < 64) ? ((1ul << level_count) - 1) : UINT64_MAX;
+            for (size_t i = 0; i < n; ++i) {
+                for (uint64_t set = symbols[i] & symbol_mask; set; set &= set - 1) {
+                    ++ones_at_shift[std::countr_zero(set)];
+                }
+            }
+            this->arena_bytes = level_count * this->level_words * sizeof(uint64_t);
+            for (uint64_t shift = 0; shift < level_count; ++shift) {
+                this->arena_bytes += level_index_bytes(n, ones_at_shift[shift]);
+            }
+            this->bits = (uint64_t*) this->allocator.allocate(this->arena_bytes);
+            this->arena_cursor = (char*) (this->bits + (level_count * this->level_words));
+            this->levels.reserve(level_count);
+            this->zeros.resize(level_count);
+            std::vector<uint64_t> current(symbols, symbols + n);
+            std::vector<uint64_t> next(n);
+            for (uint64_t l = 0; l < level_count; ++l) {
+                uint64_t shift = level_count - 1 - l;
+                uint64_t *bv = this->bits + (l * this->level_words);
+                uint64_t zero_count = 0;
+                for (size_t i = 0; i < n; ++i) {
+                    uint64_t bit = (current[i] >> shift) & 1;
+                    bv[i / 64] |= bit << (i % 64);
+                    zero_count += !bit;
+                }
+                this->zeros[l] = zero_count;
+                this->levels.emplace_back(bv, n, num_threads, LevelAllocator(&(this->arena_cursor)));
+                if ((l + 1) < level_count) {
+                    uint64_t zero_at = 0;
+                    uint64_t one_at = zero_count;
+                    for (size_t i = 0; i < n; ++i) {
+                        next[((current[i] >> shift) & 1) ? one_at++ : zero_at++] = current[i];
+                    }
+                    current.swap(next);
+                }
+            }
+            // the indices took exactly the slices sized for them
+            assert(this->arena_cursor == ((char*) this->bits + this->arena_bytes));
+        }
+
+        WaveletMatrix(const WaveletMatrix&) = delete;
+        WaveletMatrix &operator=(const WaveletMatrix&) = delete;
+
+        ~WaveletMatrix() {
+            if (this->bits) {
+                this->allocator.deallocate(this->bits, this->arena_bytes);
+            }
+        }
+
+        uint64_t size() const { return this->n; }
+        uint64_t level_count() const { return this->LEVEL_COUNT; }
+
+        // bytes of the arena, the levels' bits and indices
+        uint64_t space_usage() const { return this->arena_bytes; }
+
+        // the symbol at position i
+        uint64_t access(uint64_t i) const {
+            uint64_t symbol = 0;
+            for (uint64_t l = 0; l < this->LEVEL_COUNT; ++l) {
+                this->prefetch_below(l, i);
+                bool bit = this->get_bit(l, i);
+                symbol = (symbol << 1) | bit;
+                i = this->descend(l, i, bit);
+            }
+            return symbol;
+        }
+
+        /*
+         * access of n positions, BATCH_SIZE at a time, walking each batch down
+         * the levels together. A query's position at the next level is
+         * prefetched as soon as it is known, and is only needed once the rest
+         * of the batch has taken its step, so a batch keeps up to BATCH_SIZE
+         * misses in flight per level where a single access has one.
+         */
+        void access_batch(const uint64_t *positions, uint64_t *out, size_t n) const {
+            uint64_t at[BATCH_SIZE];
+            for (size_t first = 0; first < n; first += BATCH_SIZE) {
+                size_t count = std::min<size_t>(BATCH_SIZE, n - first);
+                for (size_t k = 0; k < count; ++k) {
+                    at[k] = positions[first + k];
+                    out[first + k] = 0;
+                    this->levels[0].prefetch_rank1(this->level_bv(0), at[k]);
+                }
+                for (uint64_t l = 0; l < this->LEVEL_COUNT; ++l) {
+                    bool last = (l + 1) == this->LEVEL_COUNT;
+                    for (size_t k = 0; k < count; ++k) {
+                        bool bit = this->get_bit(l, at[k]);
+                        out[first + k] = (out[first + k] << 1) | bit;
+                        at[k] = this->descend(l, at[k], bit);
+                        if (!last) {
+                            this->levels[l + 1].prefetch_rank1(this->level_bv(l + 1), at[k]);
+                        }
+                    }
+                }
+            }
+        }
+
+        // occurrences of symbol in [0, i)
+        uint64_t rank(uint64_t symbol, uint64_t i) const {
+            // the levels only hold the low LEVEL_COUNT bits of a symbol
+            if ((this->LEVEL_COUNT < 64) && ((symbol >> this->LEVEL_COUNT) != 0)) {
+                return 0;
+            }
+            uint64_t start = 0;
+            for (uint64_t l = 0; l < this->LEVEL_COUNT; ++l) {
+                bool bit = (symbol >> (this->LEVEL_COUNT - 1 - l)) & 1;
+                this->prefetch_below(l, i);
+                this->prefetch_below(l, start);
+                i = this->descend(l, i, bit);
+                start = this->descend(l, start, bit);
+            }
+            return i - start;
+        }
+
+        // position of the k-th occurrence of symbol, 1-based like
+        // Orzo::select1, or size() if it occurs fewer than k times
+        uint64_t select(uint64_t symbol, uint64_t k) const {
+            if ((k == 0) || ((this->LEVEL_COUNT < 64) && ((symbol >> this->LEVEL_COUNT) != 0))) {
+                return this->n;
+            }
+            // the symbol's run at the bottom is [start, end)
+            uint64_t start = 0;
+            uint64_t end = this->n;
+            for (uint64_t l = 0; l < this->LEVEL_COUNT; ++l) {
+                bool bit = (symbol >> (this->LEVEL_COUNT - 1 - l)) & 1;
+                this->prefetch_below(l, start);
+                this->prefetch_below(l, end);
+                start = this->descend(l, start, bit);
+                end = this->descend(l, end, bit);
+            }
+            if ((end - start) < k) {
+                return this->n;
+            }
+            uint64_t position = start + k - 1;
+            for (uint64_t l = this->LEVEL_COUNT; l-- > 0; ) {
+                bool bit = (symbol >> (this->LEVEL_COUNT - 1 - l)) & 1;
+                position = (bit)
+                    ? this->levels[l].select1(this->level_bv(l), position - this->zeros[l] + 1)
+                    : this->levels[l].select0(this->level_bv(l), position + 1);
+            }
+            return position;
+        }
+
+        // the k-th smallest symbol (0-based) of [begin, end), k < end - begin
+        uint64_t range_quantile(uint64_t begin, uint64_t end, uint64_t k) const {
+            uint64_t symbol = 0;
+            for (uint64_t l = 0; l < this->LEVEL_COUNT; ++l) {
+                this->prefetch_below(l, begin);
+                this->prefetch_below(l, end);
+                uint64_t begin_ones = this->level_rank1(l, begin);
+                uint64_t end_ones = this->level_rank1(l, end);
+                uint64_t zeros_in_range = (end - end_ones) - (begin - begin_ones);
+                if (k < zeros_in_range) {
+                    begin -= begin_ones;
+                    end -= end_ones;
+                    symbol <<= 1;
+                } else {
+                    k -= zeros_in_range;
+                    begin = this->zeros[l] + begin_ones;
+                    end = this->zeros[l] + end_ones;
+                    symbol = (symbol << 1) | 1;
+                }
+            }
+            return symbol;
+        }
+
+};
+
+#endif /* WAVELET_MATRIX_H */
@@ -1,12 +1,23 @@
+# one process sweeps every size, sparsity, pattern and run, FORMAT=json for JSON
 fname="results.csv"
-echo "approach,query_type,sparsity,size,time" > $fname
-for query_type in "rank" "select"; do
-    for sparsity in 10 50 90; do
-        for size in 24 26 28 30 32 34; do
-            full_size=$((2 ** $size))
-            for run in {1..5}; do
-                ./bin/orzo-benchmark $query_type $full_size $sparsity $run >> $fname
-            done
+format_flag=""
+if [ "$FORMAT" = "json" ]; then
+    fname="results.json"
+    format_flag="--json"
+fi
+./bin/orzo-suite --queries rank,select --sparsities 10,50,90 \
+    --sizes 2^24,2^26,2^28,2^30,2^32,2^34 --runs 5 $format_flag > $fname
+
+# sizes past memory are generated to disk and queried in place, orzo only,
+# each run to its own file as every one writes a whole CSV or JSON document
+if [ -n "$LARGE_DIR" ]; then
+    for size in 2^36 2^38 2^40; do
+        for sparsity in 10 50 90; do
+            ./bin/orzo-suite --write $LARGE_DIR/bv.bin --sizes $size --sparsities $sparsity
+            ./bin/orzo-suite --file $LARGE_DIR/bv.bin --map --structures orzo \
+                --queries rank,select --runs 5 $format_flag \
+                > large_$(echo $size | tr '^' '_')_${sparsity}_$fname
         done
     done
-done
+    rm -f $LARGE_DIR/bv.bin
+fi